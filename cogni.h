@@ -5,9 +5,19 @@
 #include <math.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+#ifdef COGNI_THREADS
+#include <stdatomic.h>
+#include <threads.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+#endif
 
 #ifndef COGNI_DEF
 #ifdef COGNI_STATIC
@@ -36,6 +46,86 @@ typedef int error;
 
 typedef float (*activision)(float);
 
+// register block of the gemm microkernel, NR is the vectorized direction
+#ifndef COGNI_GEMM_MR
+#define COGNI_GEMM_MR 4
+#endif
+#ifndef COGNI_GEMM_NR
+#define COGNI_GEMM_NR 8
+#endif
+// layers smaller then this (batch * in * out) are not worth packing
+#ifndef COGNI_GEMM_THRESHOLD
+#define COGNI_GEMM_THRESHOLD 32768
+#endif
+// rows in every chunk of a data parallel batch
+#ifndef COGNI_REDUCE_CHUNK
+#define COGNI_REDUCE_CHUNK 16
+#endif
+// gradient buffers of a deterministic batch, the chunks are split in this many runs that are
+// added by a fixed tree. it bounds the memory and the useful threads, not the rows
+#ifndef COGNI_REDUCE_SHARDS
+#define COGNI_REDUCE_SHARDS 32
+#endif
+// the dot products of the deterministic mode add their elements in this many lanes
+#ifndef COGNI_REDUCE_LANES
+#define COGNI_REDUCE_LANES 8
+#endif
+// the parameters of a layer start on a cache line
+#ifndef COGNI_CACHE_LINE
+#define COGNI_CACHE_LINE 64
+#endif
+// the default allocator, ctx is the ctx of the Allocator
+#ifndef COGNI_MALLOC
+#define COGNI_MALLOC(size, ctx) malloc(size)
+#endif
+#ifndef COGNI_FREE
+#define COGNI_FREE(ptr, ctx) free(ptr)
+#endif
+
+typedef enum
+{
+    COG_MEM_PARAMETERS = 0,
+    COG_MEM_GRADIENTS,
+    COG_MEM_ACTIVATIONS,
+    COG_MEM_DATASET,
+    COG_MEM_OTHER,
+    COG_MEM_LEN
+} Memory_type;
+
+typedef struct Allocator
+{
+    void* (*alloc)(void* ctx, size_t size);          // NULL on failure
+    void (*free)(void* ctx, void* ptr, size_t size); // size is the one given to alloc
+    void* ctx;
+} Allocator;
+
+typedef struct Arena
+{
+    // bump allocator over a buffer of the user (hugepages, a budget per model...)
+    char* base;
+    size_t size;
+    size_t used;
+    size_t peak;
+} Arena;
+
+typedef struct GemmConfig
+{
+    size_t mc; // rows of the packed a block - [mc x kc] should fit in L2
+    size_t kc; // depth of the panels - [kc x NR] of b should stay in L1
+    size_t nc; // columns of the packed b block - [kc x nc] should fit in L3
+} GemmConfig;
+
+typedef struct TuneEntry
+{
+    // the shape of cog_layer_run_batch
+    size_t batch_size;
+    size_t in;
+    size_t out;
+
+    bool use_gemm; // else the neuron loops
+    GemmConfig config;
+} TuneEntry;
+
 typedef struct _Neuron
 {
     // weights and bias
@@ -52,7 +142,7 @@ typedef struct _Neuron
 typedef struct LayerFC
 {
     Neuron* neurons;
-    float* inputs;
+    const float* inputs; // reference to the last xs, needed only for backprop
     float* outputs;
     float* part_derive;
     size_t len;
@@ -66,6 +156,34 @@ typedef struct LayerActivision
     activision fun_derive;
 } LayerActivision;
 
+typedef struct LayerLowRank
+{
+    LayerFC* first;  // [rank x in] no bias
+    LayerFC* second; // [out x rank] with the original bias
+    size_t rank;
+    float* part_derive; // [rank] the derive by the outputs of first, summed over the outputs
+} LayerLowRank;
+
+typedef struct LayerEmbedding
+{
+    float* w;  // [vocab x dim] one row per id
+    float* dw; // [vocab x dim] only the touched rows are not zero
+    size_t vocab;
+    size_t dim;
+
+    // rows with a gradient since the last zero_grad
+    size_t* touched;
+    size_t touched_len;
+    bool* is_touched;
+} LayerEmbedding;
+
+typedef enum
+{
+    COG_FACTOR_SVD = 0,    // exact truncated svd (one sided jacobi)
+    COG_FACTOR_RANDOMIZED, // randomized range finder then svd of the small projection
+    COG_FACTOR_LEN
+} Factor_type;
+
 typedef enum
 {
     NONE = 0,
@@ -75,6 +193,130 @@ typedef enum
     ACTIVISION_LEN
 } Activision_type;
 
+typedef struct Network
+{
+    LayerFC** layers;
+    Activision_type* activisions; // activision after every layer
+    size_t len;
+} Network;
+
+typedef struct NetworkPlan
+{
+    // all the intermediate activations of an inference live in the two ping pong buffers
+    float* buffers[2];
+    size_t width;
+    size_t max_batch;
+} NetworkPlan;
+
+typedef struct LayerContext
+{
+    // what a forward leaves for its backward
+    const float* inputs;  // reference to xs [batch_size x in]
+    const float* outputs; // reference to the activated ys [batch_size x out]
+    size_t batch_size;
+
+    // private [dw | db] with the layout of the layer parameters
+    float* dw;
+    float* db;
+    size_t params_len;
+} LayerContext;
+
+typedef struct NetworkContext
+{
+    LayerContext** layers;
+    float* activations; // every layer outputs for max_batch samples back to back
+    float* deltas[2];   // [max_batch x widest layer]
+    size_t len;
+    size_t max_batch;
+} NetworkContext;
+
+typedef struct ModelBatch
+{
+    size_t models; // K same shape networks trained in lockstep
+    size_t layers_len;
+    size_t* sizes;
+    Activision_type* activisions;
+    float* lr;
+
+    // interleaved per layer: element e of model k is at [e * models + k] so the models are the
+    // vectorized direction
+    float** w; // [out x in x models]
+    float** b; // [out x models]
+    float** dw;
+    float** db;
+    float* inputs;   // [in x models]
+    float** outputs; // [out x models]
+    float** deltas;  // [out x models]
+} ModelBatch;
+
+#ifdef COGNI_THREADS
+typedef struct Checkpoint
+{
+    char* path;
+    char* tmp_path;
+
+    // snapshot of every layer [w | b] back to back
+    float* staging;
+    size_t* w_lens;
+    size_t* b_lens;
+    size_t layers_len;
+    size_t step;
+
+    thrd_t writer;
+    Allocator allocator; // of the thread that called init, used by the writer
+    mtx_t lock;
+    cnd_t cond;
+    bool pending;
+    bool stop;
+    error last_error;
+} Checkpoint;
+
+typedef struct ModelSnapshot
+{
+    float* params; // every layer [w | b] back to back
+    size_t version;
+    atomic_size_t readers;
+} ModelSnapshot;
+
+typedef struct ModelPublisher
+{
+    size_t* sizes;
+    Activision_type* activisions;
+    size_t layers_len;
+    size_t params_len;
+
+    // the current slot is read by the serving threads, the others are free for the trainer
+    ModelSnapshot* slots;
+    size_t slots_len;
+    _Atomic(ModelSnapshot*) current;
+} ModelPublisher;
+#endif
+
+/* Memory */
+// All the memory of cogni comes from here. the block keeps its allocator so it can be freed after
+// cog_set_allocator changed it. with COGNI_THREADS the allocator is per thread, the threads
+// started by cogni use the allocator of the thread that started them
+COGNI_DEF void* cog_malloc(size_t size, Memory_type type);
+COGNI_DEF void* cog_calloc(size_t count, size_t size, Memory_type type);
+// alignment is a power of two
+COGNI_DEF void* cog_malloc_aligned(size_t size, size_t alignment, Memory_type type);
+// ignores NULL
+COGNI_DEF void cog_free(void* ptr);
+// returns the previous allocator
+COGNI_DEF Allocator cog_set_allocator(Allocator allocator);
+COGNI_DEF Allocator cog_get_allocator(void);
+COGNI_DEF Allocator cog_default_allocator(void);
+// bytes that were asked for, of all the threads
+COGNI_DEF size_t cog_memory_current(Memory_type type);
+COGNI_DEF size_t cog_memory_peak(Memory_type type);
+COGNI_DEF void cog_memory_reset_peak(void);
+// The arena gives its buffer in order and fails when it is full, a free gives back the memory only
+// if it was the last allocation. not thread safe
+COGNI_DEF void cog_arena_init(Arena* arena, void* buffer, size_t size);
+COGNI_DEF Allocator cog_arena_allocator(Arena* arena);
+// everything allocated from the arena is gone
+COGNI_DEF void cog_arena_reset(Arena* arena);
+
 /* Functions */
 COGNI_DEF float cog_mse(float x, float y);
 COGNI_DEF float cog_mse_deriv(float truth, float pred);
@@ -96,7 +338,7 @@ COGNI_DEF error cog_read_weights_p(FILE* fp, float* weights, size_t w_len, float
                                    size_t b_len);
 
 /* Neurons */
-// Neuron init using malloc - use neuron_destroy
+// Neuron init using cog_malloc - use neuron_destroy
 COGNI_DEF Neuron* cog_neuron_init_m(float w[], float* b, float dw[], float* db, size_t w_len);
 COGNI_DEF Neuron* cog_neuron_init(Neuron* neuron, float w[], float* b, float dw[], float* db,
                                   size_t w_len);
@@ -115,9 +357,48 @@ COGNI_DEF void cog_neuron_part_derive(Neuron* neuron, float* part_derives);
 COGNI_DEF void cog_apply_derives(float* w, float* dw, size_t w_len, float* b, float* db,
                                  size_t b_len, float lr);
 
+/* Gemm */
+// c[m x n] = alpha * op(a)[m x k] * op(b)[k x n] + beta * c, row major, op transposes if trans
+// without memory for the packed panels it runs the plain loops, c is always computed
+COGNI_DEF void cog_gemm(bool trans_a, bool trans_b, size_t m, size_t n, size_t k, float alpha,
+                        const float* a, size_t lda, const float* b, size_t ldb, float beta,
+                        float* c, size_t ldc);
+COGNI_DEF GemmConfig cog_gemm_get_config(void);
+COGNI_DEF void cog_gemm_set_config(GemmConfig config);
+
+/* Auto tuning */
+// Benchmark the neuron loops and gemm blockings for the shape and keep the fastest in the table
+// that cog_layer_run_batch looks at. tune and load before running layers from other threads.
+// only these two are tuned: the kernels have no unroll or simd variants to pick from and the
+// thread counts are given by the caller
+COGNI_DEF error cog_tune_layer(const LayerFC* layer, size_t batch_size);
+COGNI_DEF error cog_tune_network(const Network* net, size_t batch_size);
+// NULL when the shape was not tuned
+COGNI_DEF const TuneEntry* cog_tune_lookup(size_t batch_size, size_t in, size_t out);
+COGNI_DEF void cog_tune_clear(void);
+// The cache file has lines of every cpu model, only the lines of this cpu are loaded and the save
+// keeps the lines of the others. a missing file loads nothing and is not an error, lines with a
+// zero size are skipped
+COGNI_DEF error cog_tune_load(const char* path);
+COGNI_DEF error cog_tune_save(const char* path);
+// "model name" of /proc/cpuinfo or "unknown" into model, cut to model_len - 1 chars
+COGNI_DEF void cog_cpu_model(char* model, size_t model_len);
+// wall clock seconds, the clock of the tuning timings
+COGNI_DEF double cog_seconds(void);
+
+/* Deterministic mode */
+// Every sum has a fixed order that depends only on the shapes: the dot products go through
+// COGNI_REDUCE_LANES lanes added by a tree and the tuned kernels are not used, as their choice
+// depends on timings. hogwild is never deterministic. set it before starting threads
+COGNI_DEF void cog_set_deterministic(bool deterministic);
+COGNI_DEF bool cog_is_deterministic(void);
+
 /* Layers */
 COGNI_DEF LayerFC* cog_layer_init(size_t in_features, size_t out_features);
 COGNI_DEF void cog_layer_destroy(LayerFC* layer);
+// floats of the one [w | b] block, the same for [dw | db]
+COGNI_DEF size_t cog_layer_params_len(const LayerFC* layer);
+// xs is kept by reference for the backprop - it must live until cog_layer_backpropagate
 COGNI_DEF float* cog_layer_run(LayerFC* layer, const float* xs);
 COGNI_DEF void cog_layer_zero_grad(LayerFC* layer);
 COGNI_DEF void cog_layer_backpropagate(LayerFC* layer, const float* partial_derive);
@@ -125,10 +406,180 @@ COGNI_DEF void cog_layer_backpropagate_batch(LayerFC* layer, const float* partia
                                              size_t batch_size);
 COGNI_DEF void cog_layer_part_derive(LayerFC* layer);
 COGNI_DEF void cog_layer_apply_derives(LayerFC* layer, float lr);
+// Make the layer take raw x as if it was normalized: x' = (x - shift) * scale
+COGNI_DEF void cog_layer_fold_input_affine(LayerFC* layer, const float* scale, const float* shift);
 
 COGNI_DEF LayerActivision cog_layer_activision_init(Activision_type type);
 COGNI_DEF float* cog_layer_activate(const LayerActivision fun, LayerFC* layer);
 
+COGNI_DEF void cog_layer_run_batch(const LayerFC* layer, const float* xs, float* ys,
+                                   size_t batch_size);
+COGNI_DEF void cog_activate_array(Activision_type type, float* xs, size_t len);
+// deltas are [batch_size x out] the derive by the activated outputs ys, they are turned into the
+// derive by the linear outputs. grad_in [batch_size x in] (can be NULL) is the derive by xs
+COGNI_DEF void cog_layer_backward_batch(LayerFC* layer, Activision_type type, const float* xs,
+                                        const float* ys, float* deltas, float* grad_in,
+                                        size_t batch_size);
+
+/* Network */
+// sizes are the inputs and then every layer outputs (layers_len + 1) - use cog_network_destroy
+COGNI_DEF Network* cog_network_init(const size_t* sizes, const Activision_type* activisions,
+                                    size_t layers_len);
+COGNI_DEF void cog_network_destroy(Network* net);
+// same layers and weights, for runs that must start from the same init - use cog_network_destroy
+COGNI_DEF Network* cog_network_clone(const Network* net);
+COGNI_DEF size_t cog_network_in_features(const Network* net);
+COGNI_DEF size_t cog_network_out_features(const Network* net);
+COGNI_DEF size_t cog_network_max_width(const Network* net);
+COGNI_DEF size_t cog_network_params_len(const Network* net);
+// params are the [w | b] of every layer one after the other, cog_network_params_len floats
+COGNI_DEF void cog_network_get_params(const Network* net, float* params);
+COGNI_DEF void cog_network_set_params(Network* net, const float* params);
+COGNI_DEF float* cog_network_run(Network* net, const float* xs);
+// scratch is 2 * batch_size * cog_network_max_width floats, returns the outputs inside scratch
+COGNI_DEF float* cog_network_run_batch(const Network* net, const float* xs, size_t batch_size,
+                                       float* scratch);
+// the mse summed over the outputs, avg over the rows. row i is xs[i * stride] and its targets
+// ys[i * stride]
+COGNI_DEF float cog_network_mse(Network* net, const float* xs, const float* ys, size_t stride,
+                                size_t rows);
+
+/* Execution plan */
+// Inference buffers for up to max_batch samples - use cog_network_plan_destroy
+COGNI_DEF NetworkPlan* cog_network_plan_init(const Network* net, size_t max_batch);
+COGNI_DEF void cog_network_plan_destroy(NetworkPlan* plan);
+// returns the outputs inside the plan buffers, valid until the next run
+COGNI_DEF float* cog_network_plan_run(const Network* net, NetworkPlan* plan, const float* xs,
+                                      size_t batch_size);
+
+/* Inference graph */
+// Equivalent network for serving - use cog_network_destroy. It takes the raw inputs that net took
+// normalized as (x - shift) * scale (both NULL for none), and layers with no activision between
+// them are merged into one matrix when the merged matrix is not bigger
+COGNI_DEF Network* cog_network_optimize(const Network* net, const float* scale, const float* shift);
+COGNI_DEF error cog_network_write(const char* path, const Network* net);
+// use cog_network_destroy
+COGNI_DEF Network* cog_network_read(const char* path);
+
+/* Execution contexts */
+// Per thread state of a layer, so many threads can use one const layer - use
+// cog_layer_context_destroy
+COGNI_DEF LayerContext* cog_layer_context_init(const LayerFC* layer);
+COGNI_DEF void cog_layer_context_destroy(LayerContext* ctx);
+// ys [batch_size x out] = activision(xs * w^T + b), xs and ys are kept by reference for backward
+COGNI_DEF void cog_layer_forward(const LayerFC* layer, Activision_type type, LayerContext* ctx,
+                                 const float* xs, float* ys, size_t batch_size);
+// like cog_layer_backward_batch on the last forward, the gradients go to the context
+COGNI_DEF void cog_layer_backward(const LayerFC* layer, Activision_type type, LayerContext* ctx,
+                                  float* deltas, float* grad_in);
+COGNI_DEF void cog_layer_context_zero_grad(LayerContext* ctx);
+COGNI_DEF void cog_layer_context_apply(LayerFC* layer, const LayerContext* ctx, float lr);
+// Per thread state of a network for up to max_batch samples - use cog_network_context_destroy
+COGNI_DEF NetworkContext* cog_network_context_init(const Network* net, size_t max_batch);
+COGNI_DEF void cog_network_context_destroy(NetworkContext* ctx);
+// returns the outputs inside the context, valid until the next forward. NULL when batch_size is
+// bigger then the context
+COGNI_DEF float* cog_network_forward(const Network* net, NetworkContext* ctx, const float* xs,
+                                     size_t batch_size);
+// partial_derive [batch_size x out] is the loss derive by the outputs of the last forward
+COGNI_DEF void cog_network_backward(const Network* net, NetworkContext* ctx,
+                                    const float* partial_derive);
+COGNI_DEF void cog_network_context_zero_grad(NetworkContext* ctx);
+COGNI_DEF void cog_network_context_apply(Network* net, const NetworkContext* ctx, float lr);
+
+/* Model batch */
+// seeds are per model for the weights init - use cog_model_batch_destroy
+COGNI_DEF ModelBatch* cog_model_batch_init(const size_t* sizes, const Activision_type* activisions,
+                                           size_t layers_len, size_t models,
+                                           const unsigned* seeds);
+COGNI_DEF void cog_model_batch_destroy(ModelBatch* batch);
+// xs is shared by all the models, returns the outputs [out x models]
+COGNI_DEF float* cog_model_batch_run(ModelBatch* batch, const float* xs);
+COGNI_DEF void cog_model_batch_zero_grad(ModelBatch* batch);
+// partial_derive [out x models] is the loss derive by the outputs of the last run
+COGNI_DEF void cog_model_batch_backpropagate_batch(ModelBatch* batch, const float* partial_derive,
+                                                   size_t batch_size);
+// uses the lr of every model
+COGNI_DEF void cog_model_batch_apply_derives(ModelBatch* batch);
+// copy one model to/from a network of the same shape
+COGNI_DEF void cog_model_batch_export(const ModelBatch* batch, size_t model, Network* net);
+COGNI_DEF void cog_model_batch_import(ModelBatch* batch, size_t model, const Network* net);
+
+/* Low rank */
+// Replace the [out x in] weights with [out x rank]*[rank x in] - use cog_layer_lowrank_destroy
+COGNI_DEF LayerLowRank* cog_layer_factorize(const LayerFC* layer, size_t rank, Factor_type type,
+                                            float* rel_error);
+COGNI_DEF void cog_layer_lowrank_destroy(LayerLowRank* layer);
+COGNI_DEF float* cog_layer_lowrank_run(LayerLowRank* layer, const float* xs);
+COGNI_DEF void cog_layer_lowrank_zero_grad(LayerLowRank* layer);
+COGNI_DEF void cog_layer_lowrank_backpropagate_batch(LayerLowRank* layer,
+                                                     const float* partial_derive,
+                                                     size_t batch_size);
+COGNI_DEF void cog_layer_lowrank_apply_derives(LayerLowRank* layer, float lr);
+// errors[r] is the relative frobenius error of keeping rank r + 1
+COGNI_DEF error cog_layer_rank_errors(const LayerFC* layer, float* errors, size_t errors_len);
+
+/* Embedding */
+// Lookup table of dim floats per id in [0, vocab) - use cog_embedding_destroy
+COGNI_DEF LayerEmbedding* cog_embedding_init(size_t vocab, size_t dim);
+COGNI_DEF void cog_embedding_destroy(LayerEmbedding* layer);
+// ys[batch_size x dim] are the rows of ids, fails on an id out of the vocab
+COGNI_DEF error cog_embedding_run(const LayerEmbedding* layer, const size_t* ids, float* ys,
+                                  size_t batch_size);
+// deltas[batch_size x dim] is the loss derive by ys, only the rows of ids get a gradient. fails
+// on an id out of the vocab before any gradient is added
+COGNI_DEF error cog_embedding_backward(LayerEmbedding* layer, const size_t* ids,
+                                       const float* deltas, size_t batch_size);
+// zero_grad and apply_derives touch only the rows used since the last zero_grad
+COGNI_DEF void cog_embedding_zero_grad(LayerEmbedding* layer);
+COGNI_DEF void cog_embedding_apply_derives(LayerEmbedding* layer, float lr);
+
+#ifdef COGNI_THREADS
+/* Checkpoints */
+// Background writer of the layers parameters - use cog_checkpoint_destroy
+COGNI_DEF Checkpoint* cog_checkpoint_init(const char* path, LayerFC** layers, size_t layers_len);
+// Snapshot the layers and return, the file is written atomically by the writer thread.
+// returns the status of the previous write
+COGNI_DEF error cog_checkpoint_save(Checkpoint* checkpoint, LayerFC** layers, size_t step);
+// Wait for the last save to be on the disk and return its status
+COGNI_DEF error cog_checkpoint_wait(Checkpoint* checkpoint);
+COGNI_DEF void cog_checkpoint_destroy(Checkpoint* checkpoint);
+
+/* Online publishing */
+// Versions of the parameters of net for concurrent readers - use cog_publisher_destroy
+COGNI_DEF ModelPublisher* cog_publisher_init(const Network* net, size_t slots_len);
+COGNI_DEF void cog_publisher_destroy(ModelPublisher* publisher);
+// Single trainer: copy net into a free slot and swap it in. returns 1 when every other slot is
+// still read, the trainer can keep training and publish later
+COGNI_DEF error cog_publisher_publish(ModelPublisher* publisher, const Network* net);
+// Lock free: the snapshot does not change until it is released
+COGNI_DEF const ModelSnapshot* cog_publisher_acquire(ModelPublisher* publisher);
+COGNI_DEF void cog_publisher_release(ModelPublisher* publisher, const ModelSnapshot* snapshot);
+// scratch is 2 * the widest layer floats, returns the outputs inside scratch
+COGNI_DEF float* cog_snapshot_run(const ModelPublisher* publisher, const ModelSnapshot* snapshot,
+                                  const float* xs, float* scratch);
+
+/* Hogwild */
+// Per sample sgd on the mse with threads_len threads that update the shared weights without locks.
+// row i is xs[i * stride] and its targets ys[i * stride], loss is the avg mse of the last epoch
+COGNI_DEF error cog_network_train_hogwild(Network* net, const float* xs, const float* ys,
+                                          size_t stride, size_t rows, size_t epochs, float lr,
+                                          size_t threads_len, float* loss);
+
+/* Data parallel */
+// One gradient step on the mse of all the rows with threads_len threads, row i is xs[i * stride]
+// and its targets ys[i * stride], loss is the avg mse before the step. the rows are cut in chunks
+// of COGNI_REDUCE_CHUNK. in deterministic mode the chunks are split in COGNI_REDUCE_SHARDS runs
+// that depend only on rows, every run adds its chunks in order into its own gradients and the
+// runs are added by a fixed tree, so the step is the same bits for any threads_len. else every
+// thread adds its chunks into its own gradients
+COGNI_DEF error cog_network_train_step_parallel(Network* net, const float* xs, const float* ys,
+                                                size_t stride, size_t rows, float lr,
+                                                size_t threads_len, float* loss);
+#endif
+COGNI_DEF error cog_checkpoint_resume(const char* path, LayerFC** layers, size_t layers_len,
+                                      size_t* step);
+
 /* Printing and debug */
 COGNI_DEF void cog_print_layer(const LayerFC* layer, bool print_derive, const char* layer_name);
 COGNI_DEF void cog_print_array(float* array, size_t len, const char* format, ...);
@@ -141,6 +592,7 @@ COGNI_DEF void cog_array_rand_f(float* array, size_t len, float min, float max);
 
 #define COGNI_POW2(x) ((x) * (x))
 #define UNUSED(var) (void)var
+#define COGNI_ARRAY_LEN(x) (sizeof(x) / sizeof *(x))
 
 static const struct
 {
@@ -156,6 +608,208 @@ static const struct
 _Static_assert((sizeof c_activision_index) / (sizeof *c_activision_index) == ACTIVISION_LEN,
                "ERROR: Please update the index of activision");
 
+/* Memory */
+// in front of every block
+typedef struct
+{
+    void* raw; // what the allocator gave
+    size_t raw_size;
+    size_t size;
+    Allocator allocator;
+    Memory_type type;
+} CogBlock;
+
+static void* cog_default_alloc(void* ctx, size_t size)
+{
+    UNUSED(ctx);
+    return COGNI_MALLOC(size, ctx);
+}
+
+static void cog_default_free(void* ctx, void* ptr, size_t size)
+{
+    UNUSED(ctx);
+    UNUSED(size);
+    COGNI_FREE(ptr, ctx);
+}
+
+#ifdef COGNI_THREADS
+static _Thread_local Allocator c_allocator = {.alloc = cog_default_alloc,
+                                              .free  = cog_default_free};
+static atomic_size_t c_memory_current[COG_MEM_LEN];
+static atomic_size_t c_memory_peak[COG_MEM_LEN];
+#else
+static Allocator c_allocator = {.alloc = cog_default_alloc, .free = cog_default_free};
+static size_t c_memory_current[COG_MEM_LEN];
+static size_t c_memory_peak[COG_MEM_LEN];
+#endif
+
+static void cog_memory_add(Memory_type type, size_t size)
+{
+#ifdef COGNI_THREADS
+    const size_t current = atomic_fetch_add(&c_memory_current[type], size) + size;
+    size_t peak          = atomic_load(&c_memory_peak[type]);
+    while (peak < current && !atomic_compare_exchange_weak(&c_memory_peak[type], &peak, current))
+    {
+    }
+#else
+    c_memory_current[type] += size;
+    if (c_memory_peak[type] < c_memory_current[type])
+    {
+        c_memory_peak[type] = c_memory_current[type];
+    }
+#endif
+}
+
+COGNI_DEF void* cog_malloc_aligned(size_t size, size_t alignment, Memory_type type)
+{
+    if (alignment < 16)
+    {
+        alignment = 16;
+    }
+    if ((alignment & (alignment - 1)) != 0 || type >= COG_MEM_LEN)
+    {
+        fprintf(stderr, "ERROR: bad alignment %zu or memory type %d\n", alignment, type);
+        return NULL;
+    }
+    if (size > SIZE_MAX - sizeof(CogBlock) - (alignment - 1))
+    {
+        fprintf(stderr, "ERROR: %zu bytes with the alignment %zu overflow\n", size, alignment);
+        return NULL;
+    }
+    // room for the block and to move the pointer up to the alignment
+    const size_t raw_size = size + sizeof(CogBlock) + alignment - 1;
+    char* raw             = c_allocator.alloc(c_allocator.ctx, raw_size);
+    if (raw == NULL)
+    {
+        return NULL;
+    }
+    const uintptr_t start   = (uintptr_t)raw + sizeof(CogBlock);
+    const uintptr_t aligned = (start + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    char* ptr               = raw + (aligned - (uintptr_t)raw);
+    ((CogBlock*)ptr)[-1]    = (CogBlock){.raw       = raw,
+                                         .raw_size  = raw_size,
+                                         .size      = size,
+                                         .allocator = c_allocator,
+                                         .type      = type};
+    cog_memory_add(type, size);
+    return ptr;
+}
+
+COGNI_DEF void* cog_malloc(size_t size, Memory_type type)
+{
+    return cog_malloc_aligned(size, 16, type);
+}
+
+COGNI_DEF void* cog_calloc(size_t count, size_t size, Memory_type type)
+{
+    if (size != 0 && count > SIZE_MAX / size)
+    {
+        return NULL;
+    }
+    void* ptr = cog_malloc(count * size, type);
+    if (ptr != NULL)
+    {
+        memset(ptr, 0, count * size);
+    }
+    return ptr;
+}
+
+COGNI_DEF void cog_free(void* ptr)
+{
+    if (ptr == NULL)
+    {
+        return;
+    }
+    const CogBlock block = ((CogBlock*)ptr)[-1];
+#ifdef COGNI_THREADS
+    atomic_fetch_sub(&c_memory_current[block.type], block.size);
+#else
+    c_memory_current[block.type] -= block.size;
+#endif
+    block.allocator.free(block.allocator.ctx, block.raw, block.raw_size);
+}
+
+COGNI_DEF Allocator cog_set_allocator(Allocator allocator)
+{
+    const Allocator previous = c_allocator;
+    c_allocator              = allocator;
+    return previous;
+}
+
+COGNI_DEF Allocator cog_get_allocator(void)
+{
+    return c_allocator;
+}
+
+COGNI_DEF Allocator cog_default_allocator(void)
+{
+    return (Allocator){.alloc = cog_default_alloc, .free = cog_default_free, .ctx = NULL};
+}
+
+COGNI_DEF size_t cog_memory_current(Memory_type type)
+{
+    return type < COG_MEM_LEN ? c_memory_current[type] : 0;
+}
+
+COGNI_DEF size_t cog_memory_peak(Memory_type type)
+{
+    return type < COG_MEM_LEN ? c_memory_peak[type] : 0;
+}
+
+COGNI_DEF void cog_memory_reset_peak(void)
+{
+    for (size_t type = 0; type < COG_MEM_LEN; type++)
+    {
+        c_memory_peak[type] = c_memory_current[type];
+    }
+}
+
+static void* cog_arena_alloc(void* ctx, size_t size)
+{
+    Arena* arena = ctx;
+    // every allocation starts aligned as malloc would and the next one starts right after it
+    const uintptr_t at = ((uintptr_t)(arena->base + arena->used) + 15) & ~(uintptr_t)15;
+    const size_t start = at - (uintptr_t)arena->base;
+    size               = (size + 15) & ~(size_t)15;
+    if (start > arena->size || size > arena->size - start)
+    {
+        fprintf(stderr, "ERROR: arena of %zu bytes is full (%zu used), %zu more asked\n",
+                arena->size, arena->used, size);
+        return NULL;
+    }
+    arena->used = start + size;
+    if (arena->peak < arena->used)
+    {
+        arena->peak = arena->used;
+    }
+    return arena->base + start;
+}
+
+static void cog_arena_free(void* ctx, void* ptr, size_t size)
+{
+    Arena* arena = ctx;
+    size         = (size + 15) & ~(size_t)15;
+    if ((char*)ptr + size == arena->base + arena->used)
+    {
+        arena->used = (char*)ptr - arena->base;
+    }
+}
+
+COGNI_DEF void cog_arena_init(Arena* arena, void* buffer, size_t size)
+{
+    *arena = (Arena){.base = buffer, .size = size, .used = 0, .peak = 0};
+}
+
+COGNI_DEF Allocator cog_arena_allocator(Arena* arena)
+{
+    return (Allocator){.alloc = cog_arena_alloc, .free = cog_arena_free, .ctx = arena};
+}
+
+COGNI_DEF void cog_arena_reset(Arena* arena)
+{
+    arena->used = 0;
+}
+
 COGNI_DEF float cog_mse(float x, float y)
 {
     return COGNI_POW2(x - y);
@@ -229,17 +883,18 @@ COGNI_DEF error cog_write_weights(const char* path, const float* weights, size_t
 COGNI_DEF error cog_write_weights_p(FILE* fp, const float* weights, size_t w_len, const float* bias,
                                     size_t b_len)
 {
+    error err = 0;
     for (size_t i = 0; i < w_len; i++)
     {
-        fprintf(fp, "%a ", weights[i]);
+        err |= fprintf(fp, "%a ", weights[i]) < 0;
     }
-    fprintf(fp, "\n");
+    err |= fprintf(fp, "\n") < 0;
     for (size_t i = 0; i < b_len; i++)
     {
-        fprintf(fp, "%a ", bias[i]);
+        err |= fprintf(fp, "%a ", bias[i]) < 0;
     }
-    fprintf(fp, "\n");
-    return 0;
+    err |= fprintf(fp, "\n") < 0;
+    return err;
 }
 
 COGNI_DEF error cog_read_weights(const char* path, float* weights, size_t w_len, float* bias,
@@ -262,20 +917,26 @@ COGNI_DEF error cog_read_weights_p(FILE* fp, float* weights, size_t w_len, float
 {
     for (size_t i = 0; i < w_len; i++)
     {
-        fscanf(fp, "%a ", &weights[i]);
+        if (fscanf(fp, "%a ", &weights[i]) != 1)
+        {
+            fprintf(stderr, "ERROR: could not read weight %zu of %zu\n", i, w_len);
+            return 1;
+        }
     }
-    fscanf(fp, "\n");
     for (size_t i = 0; i < b_len; i++)
     {
-        fscanf(fp, "%a ", &bias[i]);
+        if (fscanf(fp, "%a ", &bias[i]) != 1)
+        {
+            fprintf(stderr, "ERROR: could not read bias %zu of %zu\n", i, b_len);
+            return 1;
+        }
     }
-    fscanf(fp, "\n");
     return 0;
 }
 
 COGNI_DEF Neuron* cog_neuron_init_m(float w[], float* b, float dw[], float* db, size_t w_len)
 {
-    Neuron* neuron = (Neuron*)malloc(sizeof(Neuron));
+    Neuron* neuron = (Neuron*)cog_malloc(sizeof(Neuron), COG_MEM_OTHER);
     if (neuron == 0)
     {
         fprintf(stderr, "[ERROR] Could not allocate memory for neuron.\n");
@@ -300,11 +961,58 @@ COGNI_DEF Neuron* cog_neuron_init(Neuron* neuron, float w[], float* b, float dw[
 
 COGNI_DEF void cog_neuron_destroy(Neuron* neuron)
 {
-    free(neuron);
+    cog_free(neuron);
+}
+
+static bool c_deterministic = false;
+
+COGNI_DEF void cog_set_deterministic(bool deterministic)
+{
+    c_deterministic = deterministic;
+}
+
+COGNI_DEF bool cog_is_deterministic(void)
+{
+    return c_deterministic;
+}
+
+/* Add count vectors of len floats back to back into the first one by a pairwise tree over the
+   vector index: 0 += 1, 2 += 3, ... then 0 += 2, 4 += 6, ... */
+static void cog_reduce_tree(float* vectors, size_t count, size_t len)
+{
+    for (size_t step = 1; step < count; step *= 2)
+    {
+        for (size_t v = 0; v + step < count; v += 2 * step)
+        {
+            float* dst       = &vectors[v * len];
+            const float* src = &vectors[(v + step) * len];
+            for (size_t i = 0; i < len; i++)
+            {
+                dst[i] += src[i];
+            }
+        }
+    }
+}
+
+/* w . x in the order of a vector loop: lane j gets the elements j, j + LANES, ... */
+static float cog_dot_tree(const float* w, const float* x, size_t len)
+{
+    float lanes[COGNI_REDUCE_LANES] = {0};
+    for (size_t i = 0; i < len; i++)
+    {
+        lanes[i % COGNI_REDUCE_LANES] += w[i] * x[i];
+    }
+    cog_reduce_tree(lanes, COGNI_REDUCE_LANES, 1);
+    return lanes[0];
 }
 
 COGNI_DEF float cog_calculate_linear(const float* w, const float* x, size_t len, float b)
 {
+    if (c_deterministic)
+    {
+        return cog_dot_tree(w, x, len) + b;
+    }
+
     float sum = 0.f;
     for (size_t i = 0; i < len; i++)
     {
@@ -360,6 +1068,11 @@ COGNI_DEF void cog_apply_derives(float* w, float* dw, size_t w_len, float* b, fl
     }
 }
 
+COGNI_DEF size_t cog_layer_params_len(const LayerFC* layer)
+{
+    return layer->len * (layer->neurons[0].w_len + 1);
+}
+
 COGNI_DEF void cog_layer_zero_grad(LayerFC* layer)
 {
     memset(layer->neurons[0].dw, 0,
@@ -367,44 +1080,47 @@ COGNI_DEF void cog_layer_zero_grad(LayerFC* layer)
     memset(layer->neurons[0].db, 0, (sizeof layer->neurons[0].db[0]) * layer->len);
 }
 
-/* use malloc on return value - use layer_destroy*/
+/* uses cog_malloc on return value - use layer_destroy*/
 COGNI_DEF LayerFC* cog_layer_init(size_t in_features, size_t out_features)
 {
-    LayerFC* layer = malloc(sizeof(LayerFC));
+    LayerFC* layer = cog_malloc(sizeof(LayerFC), COG_MEM_OTHER);
     if (layer == NULL)
     {
         fprintf(stderr, "ERROR: could not malloc layer\n");
         return NULL;
     }
 
-    layer->last_activision = NULL;
-    layer->len             = out_features;
-    layer->neurons         = malloc(sizeof(Neuron) * out_features);
-    layer->part_derive     = malloc(sizeof(float) * in_features * out_features);
-    float* w               = malloc(sizeof(float) * in_features * out_features);
-    layer->inputs          = malloc(sizeof(float) * in_features);
-    float* b               = malloc(sizeof(float) * out_features);
-    float* dw              = malloc(sizeof(float) * in_features * out_features);
-    float* db              = malloc(sizeof(float) * out_features);
-    layer->outputs         = malloc(sizeof(float) * out_features);
-    if (layer == NULL || layer->part_derive == NULL || w == NULL || layer->inputs == NULL ||
-        b == NULL || dw == NULL || db == NULL || layer->outputs == NULL)
+    // the parameters are one block [w | b] and the derivatives are [dw | db] so a layer can be
+    // snapshotted with a single memcpy
+    const size_t w_len      = in_features * out_features;
+    const size_t params_len = w_len + out_features;
+    layer->last_activision  = NULL;
+    layer->inputs           = NULL;
+    layer->len              = out_features;
+    layer->neurons          = cog_malloc(sizeof(Neuron) * out_features, COG_MEM_OTHER);
+    layer->part_derive      = cog_malloc(sizeof(float) * w_len, COG_MEM_ACTIVATIONS);
+    layer->outputs          = cog_malloc(sizeof(float) * out_features, COG_MEM_ACTIVATIONS);
+    float* w                = cog_malloc_aligned(sizeof(float) * params_len, COGNI_CACHE_LINE,
+                                                 COG_MEM_PARAMETERS);
+    float* dw               = cog_malloc_aligned(sizeof(float) * params_len, COGNI_CACHE_LINE,
+                                                 COG_MEM_GRADIENTS);
+    if (layer->neurons == NULL || layer->part_derive == NULL || layer->outputs == NULL ||
+        w == NULL || dw == NULL)
     {
         fprintf(stderr, "ERROR: could not malloc neurons data\n");
-        // TODO: check NULL for double free (define array and for loop)
-        free(layer->neurons);
-        free(layer->part_derive);
-        free(layer->inputs);
-        free(layer->outputs);
-        free(layer);
-        free(w);
-        free(b);
-        free(dw);
-        free(db);
+        // cog_free ignores NULL so every allocation that did succeed is freed
+        cog_free(dw);
+        cog_free(w);
+        cog_free(layer->outputs);
+        cog_free(layer->part_derive);
+        cog_free(layer->neurons);
+        cog_free(layer);
         return NULL;
     }
+    float* b  = &w[w_len];
+    float* db = &dw[w_len];
 
-    cog_array_rand_f(w, in_features * out_features, 0, 1);
+    cog_array_rand_f(w, w_len, 0, 1);
     cog_array_rand_f(b, out_features, 0, 1);
 
     for (size_t i = 0; i < out_features; i++)
@@ -426,20 +1142,17 @@ COGNI_DEF void cog_layer_destroy(LayerFC* layer)
 
     if (layer->len == 0)
     {
-        free(layer);
+        cog_free(layer);
         return;
     }
 
-    free(layer->neurons[0].w);
-    free(layer->neurons[0].b);
-    free(layer->neurons[0].dw);
-    free(layer->neurons[0].db);
-    free(layer->outputs);
+    cog_free(layer->neurons[0].w);
+    cog_free(layer->neurons[0].dw);
+    cog_free(layer->outputs);
 
-    free(layer->inputs);
-    free(layer->neurons);
-    free(layer->part_derive);
-    free(layer);
+    cog_free(layer->neurons);
+    cog_free(layer->part_derive);
+    cog_free(layer);
 }
 
 COGNI_DEF float* cog_layer_run(LayerFC* layer, const float* xs)
@@ -450,8 +1163,7 @@ COGNI_DEF float* cog_layer_run(LayerFC* layer, const float* xs)
     }
 
     layer->last_activision = NULL;
-    // TODO: check option to save the ref to the xs - needed only for backprop
-    memcpy(layer->inputs, xs, (sizeof *xs) * (layer->neurons[0].w_len));
+    layer->inputs          = xs;
     for (size_t i = 0; i < layer->len; i++)
     {
         layer->outputs[i] = cog_neuron_forward(&layer->neurons[i], xs);
@@ -500,6 +1212,20 @@ COGNI_DEF void cog_layer_apply_derives(LayerFC* layer, float lr)
     }
 }
 
+COGNI_DEF void cog_layer_fold_input_affine(LayerFC* layer, const float* scale, const float* shift)
+{
+    // w * ((x - shift) * scale) + b = (w * scale) * x + (b - sum(w * scale * shift))
+    for (size_t n = 0; n < layer->len; n++)
+    {
+        Neuron* neuron = &layer->neurons[n];
+        for (size_t i = 0; i < neuron->w_len; i++)
+        {
+            neuron->w[i] *= scale[i];
+            *neuron->b -= neuron->w[i] * shift[i];
+        }
+    }
+}
+
 COGNI_DEF LayerActivision cog_layer_activision_init(Activision_type type)
 {
     LayerActivision layer = {.fun        = c_activision_index[type].fun,
@@ -518,6 +1244,2850 @@ COGNI_DEF float* cog_layer_activate(const LayerActivision fun, LayerFC* layer)
     return layer->outputs;
 }
 
+static GemmConfig c_gemm_config = {.mc = 128, .kc = 256, .nc = 4096};
+
+COGNI_DEF GemmConfig cog_gemm_get_config(void)
+{
+    return c_gemm_config;
+}
+
+/* the blocks must be made of whole register blocks, and at least one */
+static GemmConfig cog_gemm_round_config(GemmConfig config)
+{
+    config.mc = (config.mc == 0) ? COGNI_GEMM_MR : config.mc;
+    config.nc = (config.nc == 0) ? COGNI_GEMM_NR : config.nc;
+    config.mc = ((config.mc + COGNI_GEMM_MR - 1) / COGNI_GEMM_MR) * COGNI_GEMM_MR;
+    config.nc = ((config.nc + COGNI_GEMM_NR - 1) / COGNI_GEMM_NR) * COGNI_GEMM_NR;
+    config.kc = (config.kc == 0) ? 1 : config.kc;
+    return config;
+}
+
+COGNI_DEF void cog_gemm_set_config(GemmConfig config)
+{
+    c_gemm_config = cog_gemm_round_config(config);
+}
+
+/* Pack op(a)[mc x kc] into panels of MR rows: panel[p * MR + i], the tail rows are zero */
+static void cog_gemm_pack_a(bool trans, const float* a, size_t lda, size_t mc, size_t kc,
+                            float* packed)
+{
+    for (size_t ir = 0; ir < mc; ir += COGNI_GEMM_MR)
+    {
+        for (size_t p = 0; p < kc; p++)
+        {
+            for (size_t i = 0; i < COGNI_GEMM_MR; i++)
+            {
+                const size_t row = ir + i;
+                float value      = 0;
+                if (row < mc)
+                {
+                    value = trans ? a[p * lda + row] : a[row * lda + p];
+                }
+                *packed++ = value;
+            }
+        }
+    }
+}
+
+/* Pack op(b)[kc x nc] into panels of NR columns: panel[p * NR + j], the tail columns are zero */
+static void cog_gemm_pack_b(bool trans, const float* b, size_t ldb, size_t kc, size_t nc,
+                            float* packed)
+{
+    for (size_t jr = 0; jr < nc; jr += COGNI_GEMM_NR)
+    {
+        for (size_t p = 0; p < kc; p++)
+        {
+            for (size_t j = 0; j < COGNI_GEMM_NR; j++)
+            {
+                const size_t col = jr + j;
+                float value      = 0;
+                if (col < nc)
+                {
+                    value = trans ? b[col * ldb + p] : b[p * ldb + col];
+                }
+                *packed++ = value;
+            }
+        }
+    }
+}
+
+/* acc[MR x NR] = a panel * b panel, the accumulator stays in registers */
+static void cog_gemm_microkernel(size_t kc, const float* restrict a, const float* restrict b,
+                                 float* restrict acc)
+{
+    float sum[COGNI_GEMM_MR][COGNI_GEMM_NR] = {{0}};
+    for (size_t p = 0; p < kc; p++)
+    {
+        for (size_t i = 0; i < COGNI_GEMM_MR; i++)
+        {
+            for (size_t j = 0; j < COGNI_GEMM_NR; j++)
+            {
+                sum[i][j] += a[p * COGNI_GEMM_MR + i] * b[p * COGNI_GEMM_NR + j];
+            }
+        }
+    }
+    memcpy(acc, sum, sizeof sum);
+}
+
+/* the unpacked loops, for when there is no memory for the panels. every block of block_k is
+   summed and added to c like the blocked gemm does, so the result is the same bits */
+static void cog_gemm_unpacked(size_t block_k, bool trans_a, bool trans_b, size_t m, size_t n,
+                              size_t k, float alpha, const float* a, size_t lda, const float* b,
+                              size_t ldb, float beta, float* c, size_t ldc)
+{
+    // k 0 still scales c by beta
+    for (size_t pc = 0; pc == 0 || pc < k; pc += block_k)
+    {
+        const size_t kc        = (k - pc < block_k) ? k - pc : block_k;
+        const float beta_block = (pc == 0) ? beta : 1;
+        for (size_t i = 0; i < m; i++)
+        {
+            for (size_t j = 0; j < n; j++)
+            {
+                float sum = 0;
+                for (size_t p = pc; p < pc + kc; p++)
+                {
+                    sum += (trans_a ? a[p * lda + i] : a[i * lda + p]) *
+                           (trans_b ? b[j * ldb + p] : b[p * ldb + j]);
+                }
+                // beta 0 must not read c, it can be uninitialized
+                const float old = (beta_block == 0) ? 0 : beta_block * c[i * ldc + j];
+                c[i * ldc + j]  = alpha * sum + old;
+            }
+        }
+    }
+}
+
+static void cog_gemm_blocked(GemmConfig config, bool trans_a, bool trans_b, size_t m, size_t n,
+                             size_t k, float alpha, const float* a, size_t lda, const float* b,
+                             size_t ldb, float beta, float* c, size_t ldc)
+{
+    config = cog_gemm_round_config(config);
+    if (k == 0)
+    {
+        cog_gemm_unpacked(config.kc, trans_a, trans_b, m, n, k, alpha, a, lda, b, ldb, beta, c,
+                          ldc);
+        return;
+    }
+
+    float* packed_a = cog_malloc(sizeof(float) * config.mc * config.kc, COG_MEM_ACTIVATIONS);
+    float* packed_b = cog_malloc(sizeof(float) * config.kc * config.nc, COG_MEM_ACTIVATIONS);
+    if (packed_a == NULL || packed_b == NULL)
+    {
+        cog_free(packed_b);
+        cog_free(packed_a);
+        cog_gemm_unpacked(config.kc, trans_a, trans_b, m, n, k, alpha, a, lda, b, ldb, beta, c,
+                          ldc);
+        return;
+    }
+
+    float acc[COGNI_GEMM_MR * COGNI_GEMM_NR];
+    for (size_t jc = 0; jc < n; jc += config.nc)
+    {
+        const size_t nc = (n - jc < config.nc) ? n - jc : config.nc;
+        for (size_t pc = 0; pc < k; pc += config.kc)
+        {
+            const size_t kc = (k - pc < config.kc) ? k - pc : config.kc;
+            // every b panel is packed once and reused by all the rows of a
+            cog_gemm_pack_b(trans_b, trans_b ? &b[jc * ldb + pc] : &b[pc * ldb + jc], ldb, kc, nc,
+                            packed_b);
+            const float beta_block = (pc == 0) ? beta : 1;
+
+            for (size_t ic = 0; ic < m; ic += config.mc)
+            {
+                const size_t mc = (m - ic < config.mc) ? m - ic : config.mc;
+                cog_gemm_pack_a(trans_a, trans_a ? &a[pc * lda + ic] : &a[ic * lda + pc], lda, mc,
+                                kc, packed_a);
+
+                for (size_t jr = 0; jr < nc; jr += COGNI_GEMM_NR)
+                {
+                    for (size_t ir = 0; ir < mc; ir += COGNI_GEMM_MR)
+                    {
+                        cog_gemm_microkernel(kc, &packed_a[ir * kc], &packed_b[jr * kc], acc);
+
+                        const size_t rows = (mc - ir < COGNI_GEMM_MR) ? mc - ir : COGNI_GEMM_MR;
+                        const size_t cols = (nc - jr < COGNI_GEMM_NR) ? nc - jr : COGNI_GEMM_NR;
+                        for (size_t i = 0; i < rows; i++)
+                        {
+                            float* c_row = &c[(ic + ir + i) * ldc + jc + jr];
+                            for (size_t j = 0; j < cols; j++)
+                            {
+                                // beta 0 must not read c, it can be uninitialized
+                                const float old = (beta_block == 0) ? 0 : beta_block * c_row[j];
+                                c_row[j]        = alpha * acc[i * COGNI_GEMM_NR + j] + old;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // in reverse so an arena gets the panels back
+    cog_free(packed_b);
+    cog_free(packed_a);
+}
+
+COGNI_DEF void cog_gemm(bool trans_a, bool trans_b, size_t m, size_t n, size_t k, float alpha,
+                        const float* a, size_t lda, const float* b, size_t ldb, float beta,
+                        float* c, size_t ldc)
+{
+    cog_gemm_blocked(c_gemm_config, trans_a, trans_b, m, n, k, alpha, a, lda, b, ldb, beta, c,
+                     ldc);
+}
+
+static TuneEntry* c_tune_table = NULL;
+static size_t c_tune_len       = 0;
+static size_t c_tune_cap       = 0;
+
+COGNI_DEF const TuneEntry* cog_tune_lookup(size_t batch_size, size_t in, size_t out)
+{
+    for (size_t i = 0; i < c_tune_len; i++)
+    {
+        const TuneEntry* entry = &c_tune_table[i];
+        if (entry->batch_size == batch_size && entry->in == in && entry->out == out)
+        {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void cog_layer_run_with(const LayerFC* layer, const float* xs, float* ys, size_t batch_size,
+                               bool use_gemm, GemmConfig config)
+{
+    const size_t in = layer->neurons[0].w_len;
+    if (use_gemm)
+    {
+        // ys = bias then ys += xs * w^T
+        for (size_t i = 0; i < batch_size; i++)
+        {
+            memcpy(&ys[i * layer->len], layer->neurons[0].b, (sizeof *ys) * layer->len);
+        }
+        cog_gemm_blocked(config, false, true, batch_size, layer->len, in, 1, xs, in,
+                         layer->neurons[0].w, in, 1, ys, layer->len);
+        return;
+    }
+
+    // neuron outer loop so every weights row is read once for the whole batch
+    for (size_t n = 0; n < layer->len; n++)
+    {
+        for (size_t i = 0; i < batch_size; i++)
+        {
+            ys[i * layer->len + n] = cog_neuron_forward(&layer->neurons[n], &xs[i * in]);
+        }
+    }
+}
+
+/* xs is [batch_size x in] and ys is [batch_size x out] */
+COGNI_DEF void cog_layer_run_batch(const LayerFC* layer, const float* xs, float* ys,
+                                   size_t batch_size)
+{
+    const size_t in = layer->neurons[0].w_len;
+    // the tuned kernel is picked by timings
+    const TuneEntry* tuned = c_deterministic ? NULL : cog_tune_lookup(batch_size, in, layer->len);
+    if (tuned != NULL)
+    {
+        cog_layer_run_with(layer, xs, ys, batch_size, tuned->use_gemm, tuned->config);
+        return;
+    }
+    cog_layer_run_with(layer, xs, ys, batch_size,
+                       batch_size * in * layer->len >= COGNI_GEMM_THRESHOLD, c_gemm_config);
+}
+
+COGNI_DEF double cog_seconds(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* best of a few timings of one run, every timing repeats the run for at least 2ms */
+static double cog_time_run(const LayerFC* layer, const float* xs, float* ys, size_t batch_size,
+                           bool use_gemm, GemmConfig config)
+{
+    cog_layer_run_with(layer, xs, ys, batch_size, use_gemm, config);
+    double best = INFINITY;
+    for (size_t timing = 0; timing < 3; timing++)
+    {
+        size_t runs        = 0;
+        const double start = cog_seconds();
+        double elapsed     = 0;
+        while (elapsed < 0.002)
+        {
+            cog_layer_run_with(layer, xs, ys, batch_size, use_gemm, config);
+            runs++;
+            elapsed = cog_seconds() - start;
+        }
+        best = fmin(best, elapsed / runs);
+    }
+    return best;
+}
+
+static size_t cog_round_up(size_t x, size_t to)
+{
+    return ((x + to - 1) / to) * to;
+}
+
+static error cog_tune_add(TuneEntry entry)
+{
+    TuneEntry* old = (TuneEntry*)cog_tune_lookup(entry.batch_size, entry.in, entry.out);
+    if (old != NULL)
+    {
+        *old = entry;
+        return 0;
+    }
+
+    if (c_tune_len == c_tune_cap)
+    {
+        const size_t cap = (c_tune_cap == 0) ? 8 : 2 * c_tune_cap;
+        TuneEntry* table = cog_malloc(sizeof(TuneEntry) * cap, COG_MEM_OTHER);
+        if (table == NULL)
+        {
+            fprintf(stderr, "ERROR: could not malloc tuning table\n");
+            return 1;
+        }
+        if (c_tune_len > 0)
+        {
+            memcpy(table, c_tune_table, sizeof(TuneEntry) * c_tune_len);
+        }
+        cog_free(c_tune_table);
+        c_tune_table = table;
+        c_tune_cap   = cap;
+    }
+    c_tune_table[c_tune_len++] = entry;
+    return 0;
+}
+
+COGNI_DEF error cog_tune_layer(const LayerFC* layer, size_t batch_size)
+{
+    const size_t in  = layer->neurons[0].w_len;
+    const size_t out = layer->len;
+    float* xs        = cog_malloc(sizeof(float) * batch_size * (in + out), COG_MEM_ACTIVATIONS);
+    if (xs == NULL)
+    {
+        fprintf(stderr, "ERROR: could not malloc tuning data\n");
+        return 1;
+    }
+    float* ys = &xs[batch_size * in];
+    cog_array_rand_f(xs, batch_size * in, -1, 1);
+
+    TuneEntry best   = {.batch_size = batch_size,
+                        .in         = in,
+                        .out        = out,
+                        .use_gemm   = false,
+                        .config     = c_gemm_config};
+    double best_time = cog_time_run(layer, xs, ys, batch_size, false, c_gemm_config);
+
+    // blocks bigger then the shape are all the same run, they are clamped so it is timed once
+    const size_t mcs[] = {32, 64, 128, 256};
+    const size_t kcs[] = {64, 128, 256, 512};
+    const size_t ncs[] = {256, 1024, 4096};
+    GemmConfig tried[COGNI_ARRAY_LEN(mcs) * COGNI_ARRAY_LEN(kcs) * COGNI_ARRAY_LEN(ncs)];
+    size_t tried_len = 0;
+    for (size_t m = 0; m < COGNI_ARRAY_LEN(mcs); m++)
+    {
+        for (size_t k = 0; k < COGNI_ARRAY_LEN(kcs); k++)
+        {
+            for (size_t n = 0; n < COGNI_ARRAY_LEN(ncs); n++)
+            {
+                const GemmConfig config = {
+                    .mc = (mcs[m] < batch_size) ? mcs[m] : cog_round_up(batch_size, COGNI_GEMM_MR),
+                    .kc = (kcs[k] < in) ? kcs[k] : in,
+                    .nc = (ncs[n] < out) ? ncs[n] : cog_round_up(out, COGNI_GEMM_NR)};
+                bool seen = false;
+                for (size_t t = 0; t < tried_len && !seen; t++)
+                {
+                    seen = tried[t].mc == config.mc && tried[t].kc == config.kc &&
+                           tried[t].nc == config.nc;
+                }
+                if (seen)
+                {
+                    continue;
+                }
+                tried[tried_len++] = config;
+
+                const double time = cog_time_run(layer, xs, ys, batch_size, true, config);
+                if (time < best_time)
+                {
+                    best_time     = time;
+                    best.use_gemm = true;
+                    best.config   = config;
+                }
+            }
+        }
+    }
+
+    cog_free(xs);
+    return cog_tune_add(best);
+}
+
+COGNI_DEF error cog_tune_network(const Network* net, size_t batch_size)
+{
+    for (size_t l = 0; l < net->len; l++)
+    {
+        const LayerFC* layer = net->layers[l];
+        if (cog_tune_lookup(batch_size, layer->neurons[0].w_len, layer->len) != NULL)
+        {
+            continue;
+        }
+        if (cog_tune_layer(layer, batch_size) != 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+COGNI_DEF void cog_tune_clear(void)
+{
+    cog_free(c_tune_table);
+    c_tune_table = NULL;
+    c_tune_len   = 0;
+    c_tune_cap   = 0;
+}
+
+COGNI_DEF void cog_cpu_model(char* model, size_t model_len)
+{
+    snprintf(model, model_len, "unknown");
+    FILE* fp = fopen("/proc/cpuinfo", "r");
+    if (fp == NULL)
+    {
+        return;
+    }
+    char line[256];
+    while (fgets(line, sizeof line, fp) != NULL)
+    {
+        char* value = strchr(line, ':');
+        if (strncmp(line, "model name", 10) != 0 || value == NULL)
+        {
+            continue;
+        }
+        value += strspn(value, ": \t");
+        value[strcspn(value, "\n")] = '\0';
+        // the model is the first field of a cache line
+        for (char* c = value; *c != '\0'; c++)
+        {
+            *c = (*c == '\t') ? ' ' : *c;
+        }
+        if (value[0] != '\0')
+        {
+            snprintf(model, model_len, "%s", value);
+        }
+        break;
+    }
+    fclose(fp);
+}
+
+/* a cache line is "<cpu model>\t<batch_size> <in> <out> <use_gemm> <mc> <kc> <nc>" */
+static bool cog_tune_parse(const char* line, const char* model, TuneEntry* entry)
+{
+    const char* tab = strchr(line, '\t');
+    if (tab == NULL || (size_t)(tab - line) != strlen(model) ||
+        strncmp(line, model, strlen(model)) != 0)
+    {
+        return false;
+    }
+    int use_gemm = 0;
+    if (sscanf(tab + 1, "%zu %zu %zu %d %zu %zu %zu", &entry->batch_size, &entry->in, &entry->out,
+               &use_gemm, &entry->config.mc, &entry->config.kc, &entry->config.nc) != 7)
+    {
+        return false;
+    }
+    // a hand edited or corrupted line must not reach the gemm, the blocks are rounded as
+    // cog_gemm_set_config does
+    if (entry->batch_size == 0 || entry->in == 0 || entry->out == 0 || entry->config.mc == 0 ||
+        entry->config.kc == 0 || entry->config.nc == 0)
+    {
+        return false;
+    }
+    entry->config   = cog_gemm_round_config(entry->config);
+    entry->use_gemm = use_gemm != 0;
+    return true;
+}
+
+COGNI_DEF error cog_tune_load(const char* path)
+{
+    FILE* fp = fopen(path, "r");
+    if (fp == 0 && errno == ENOENT)
+    {
+        // the first run, there is nothing to load yet
+        return 0;
+    }
+    if (fp == 0)
+    {
+        fprintf(stderr, "could not open file '%s': %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    char model[128];
+    cog_cpu_model(model, sizeof model);
+    char line[512];
+    error err = 0;
+    while (err == 0 && fgets(line, sizeof line, fp) != NULL)
+    {
+        TuneEntry entry;
+        if (cog_tune_parse(line, model, &entry))
+        {
+            err = cog_tune_add(entry);
+        }
+    }
+    fclose(fp);
+    return err;
+}
+
+COGNI_DEF error cog_tune_save(const char* path)
+{
+    const size_t tmp_len = strlen(path) + 5;
+    char* tmp_path       = cog_malloc(tmp_len, COG_MEM_OTHER);
+    if (tmp_path == NULL)
+    {
+        fprintf(stderr, "ERROR: could not malloc tuning cache path\n");
+        return 1;
+    }
+    snprintf(tmp_path, tmp_len, "%s.tmp", path);
+
+    FILE* out = fopen(tmp_path, "w");
+    if (out == 0)
+    {
+        fprintf(stderr, "could not open file '%s': %s\n", tmp_path, strerror(errno));
+        cog_free(tmp_path);
+        return 1;
+    }
+
+    // keep the lines of the other cpus and the shapes this run did not tune
+    char model[128];
+    cog_cpu_model(model, sizeof model);
+    FILE* in = fopen(path, "r");
+    char line[512];
+    while (in != NULL && fgets(line, sizeof line, in) != NULL)
+    {
+        TuneEntry entry;
+        if (!cog_tune_parse(line, model, &entry) ||
+            cog_tune_lookup(entry.batch_size, entry.in, entry.out) == NULL)
+        {
+            fputs(line, out);
+        }
+    }
+    if (in != NULL)
+    {
+        fclose(in);
+    }
+
+    for (size_t i = 0; i < c_tune_len; i++)
+    {
+        const TuneEntry* entry = &c_tune_table[i];
+        fprintf(out, "%s\t%zu %zu %zu %d %zu %zu %zu\n", model, entry->batch_size, entry->in,
+                entry->out, (int)entry->use_gemm, entry->config.mc, entry->config.kc,
+                entry->config.nc);
+    }
+
+    error err = (fclose(out) != 0);
+    if (err == 0 && rename(tmp_path, path) != 0)
+    {
+        fprintf(stderr, "could not rename '%s': %s\n", tmp_path, strerror(errno));
+        err = 1;
+    }
+    cog_free(tmp_path);
+    return err;
+}
+
+/* backward of a linear layer with the gradients going to dw and db */
+static void cog_linear_backward(const LayerFC* layer, Activision_type type, const float* xs,
+                                const float* ys, float* deltas, float* grad_in, float* dw,
+                                float* db, size_t batch_size)
+{
+    const size_t in  = layer->neurons[0].w_len;
+    const size_t out = layer->len;
+    const float* w   = layer->neurons[0].w;
+
+    const activision fun_derive = c_activision_index[type].fun_derive;
+    for (size_t i = 0; i < batch_size * out; i++)
+    {
+        deltas[i] = (fun_derive == NULL) ? deltas[i] : fun_derive(ys[i]) * deltas[i];
+    }
+
+    const float scale = 1.f / batch_size;
+    for (size_t i = 0; i < batch_size; i++)
+    {
+        for (size_t n = 0; n < out; n++)
+        {
+            db[n] += deltas[i * out + n] * scale;
+        }
+    }
+
+    if (batch_size * in * out >= COGNI_GEMM_THRESHOLD)
+    {
+        // dw[out x in] += deltas^T * xs / batch_size
+        cog_gemm(true, false, out, in, batch_size, scale, deltas, out, xs, in, 1, dw, in);
+        if (grad_in != NULL)
+        {
+            // grad_in[batch_size x in] = deltas * w
+            cog_gemm(false, false, batch_size, in, out, 1, deltas, out, w, in, 0, grad_in, in);
+        }
+        return;
+    }
+
+    // small layers do not pay for packing the gemm panels
+    for (size_t i = 0; i < batch_size; i++)
+    {
+        const float* x = &xs[i * in];
+        float* grad    = (grad_in != NULL) ? &grad_in[i * in] : NULL;
+        if (grad != NULL)
+        {
+            memset(grad, 0, (sizeof *grad) * in);
+        }
+        for (size_t n = 0; n < out; n++)
+        {
+            const float delta = deltas[i * out + n];
+            const float step  = delta * scale;
+            if (delta == 0)
+            {
+                // a dead unit, common after relu
+                continue;
+            }
+            for (size_t k = 0; k < in; k++)
+            {
+                dw[n * in + k] += step * x[k];
+            }
+            for (size_t k = 0; grad != NULL && k < in; k++)
+            {
+                grad[k] += delta * w[n * in + k];
+            }
+        }
+    }
+}
+
+COGNI_DEF void cog_layer_backward_batch(LayerFC* layer, Activision_type type, const float* xs,
+                                        const float* ys, float* deltas, float* grad_in,
+                                        size_t batch_size)
+{
+    cog_linear_backward(layer, type, xs, ys, deltas, grad_in, layer->neurons[0].dw,
+                        layer->neurons[0].db, batch_size);
+}
+
+COGNI_DEF void cog_activate_array(Activision_type type, float* xs, size_t len)
+{
+    const activision fun = c_activision_index[type].fun;
+    if (fun == NULL)
+    {
+        return;
+    }
+    for (size_t i = 0; i < len; i++)
+    {
+        xs[i] = fun(xs[i]);
+    }
+}
+
+COGNI_DEF Network* cog_network_init(const size_t* sizes, const Activision_type* activisions,
+                                    size_t layers_len)
+{
+    Network* net           = cog_malloc(sizeof(Network), COG_MEM_OTHER);
+    LayerFC** layers       = cog_malloc(sizeof(LayerFC*) * layers_len, COG_MEM_OTHER);
+    Activision_type* types = cog_malloc(sizeof(Activision_type) * layers_len, COG_MEM_OTHER);
+    if (net == NULL || layers == NULL || types == NULL)
+    {
+        fprintf(stderr, "ERROR: could not malloc network\n");
+        cog_free(net);
+        cog_free(layers);
+        cog_free(types);
+        return NULL;
+    }
+
+    net->layers      = layers;
+    net->activisions = types;
+    net->len         = 0;
+    for (size_t i = 0; i < layers_len; i++)
+    {
+        net->layers[i] = cog_layer_init(sizes[i], sizes[i + 1]);
+        if (net->layers[i] == NULL)
+        {
+            cog_network_destroy(net);
+            return NULL;
+        }
+        net->activisions[i] = activisions[i];
+        net->len++;
+    }
+
+    return net;
+}
+
+COGNI_DEF void cog_network_destroy(Network* net)
+{
+    if (net == NULL)
+    {
+        return;
+    }
+    for (size_t i = 0; i < net->len; i++)
+    {
+        cog_layer_destroy(net->layers[i]);
+    }
+    cog_free(net->layers);
+    cog_free(net->activisions);
+    cog_free(net);
+}
+
+COGNI_DEF Network* cog_network_clone(const Network* net)
+{
+    size_t* sizes = cog_malloc(sizeof(size_t) * (net->len + 1), COG_MEM_OTHER);
+    if (sizes == NULL)
+    {
+        fprintf(stderr, "ERROR: could not malloc network clone sizes\n");
+        return NULL;
+    }
+    sizes[0] = cog_network_in_features(net);
+    for (size_t i = 0; i < net->len; i++)
+    {
+        sizes[i + 1] = net->layers[i]->len;
+    }
+
+    Network* clone = cog_network_init(sizes, net->activisions, net->len);
+    cog_free(sizes);
+    for (size_t i = 0; clone != NULL && i < net->len; i++)
+    {
+        memcpy(clone->layers[i]->neurons[0].w, net->layers[i]->neurons[0].w,
+               sizeof(float) * cog_layer_params_len(net->layers[i]));
+    }
+    return clone;
+}
+
+COGNI_DEF size_t cog_network_in_features(const Network* net)
+{
+    return net->layers[0]->neurons[0].w_len;
+}
+
+COGNI_DEF size_t cog_network_out_features(const Network* net)
+{
+    return net->layers[net->len - 1]->len;
+}
+
+COGNI_DEF size_t cog_network_max_width(const Network* net)
+{
+    size_t width = cog_network_in_features(net);
+    for (size_t i = 0; i < net->len; i++)
+    {
+        width = (net->layers[i]->len > width) ? net->layers[i]->len : width;
+    }
+    return width;
+}
+
+COGNI_DEF size_t cog_network_params_len(const Network* net)
+{
+    size_t len = 0;
+    for (size_t i = 0; i < net->len; i++)
+    {
+        len += cog_layer_params_len(net->layers[i]);
+    }
+    return len;
+}
+
+COGNI_DEF void cog_network_get_params(const Network* net, float* params)
+{
+    for (size_t i = 0; i < net->len; i++)
+    {
+        const size_t len = cog_layer_params_len(net->layers[i]);
+        memcpy(params, net->layers[i]->neurons[0].w, (sizeof *params) * len);
+        params += len;
+    }
+}
+
+COGNI_DEF void cog_network_set_params(Network* net, const float* params)
+{
+    for (size_t i = 0; i < net->len; i++)
+    {
+        const size_t len = cog_layer_params_len(net->layers[i]);
+        memcpy(net->layers[i]->neurons[0].w, params, (sizeof *params) * len);
+        params += len;
+    }
+}
+
+COGNI_DEF float* cog_network_run(Network* net, const float* xs)
+{
+    for (size_t i = 0; i < net->len; i++)
+    {
+        xs = cog_layer_run(net->layers[i], xs);
+        if (net->activisions[i] != NONE)
+        {
+            cog_layer_activate(cog_layer_activision_init(net->activisions[i]), net->layers[i]);
+        }
+    }
+    return net->layers[net->len - 1]->outputs;
+}
+
+COGNI_DEF float* cog_network_run_batch(const Network* net, const float* xs, size_t batch_size,
+                                       float* scratch)
+{
+    // ping pong between the two halves of the scratch
+    float* buffers[2] = {scratch, scratch + batch_size * cog_network_max_width(net)};
+    float* ys         = NULL;
+    for (size_t i = 0; i < net->len; i++)
+    {
+        ys = buffers[i % 2];
+        cog_layer_run_batch(net->layers[i], xs, ys, batch_size);
+        cog_activate_array(net->activisions[i], ys, batch_size * net->layers[i]->len);
+        xs = ys;
+    }
+    return ys;
+}
+
+COGNI_DEF float cog_network_mse(Network* net, const float* xs, const float* ys, size_t stride,
+                                size_t rows)
+{
+    const size_t out_len = cog_network_out_features(net);
+    float loss           = 0;
+    for (size_t i = 0; i < rows; i++)
+    {
+        const float* pred = cog_network_run(net, &xs[i * stride]);
+        for (size_t n = 0; n < out_len; n++)
+        {
+            loss += cog_mse(ys[i * stride + n], pred[n]);
+        }
+    }
+    return loss / rows;
+}
+
+/* Layers [first, last) are merged if every layer before last has no activision. the cost of the
+   merged [out x in] is compared to running the layers one after the other */
+static size_t cog_mergeable_until(const Network* net, size_t first)
+{
+    const size_t in = net->layers[first]->neurons[0].w_len;
+    size_t last     = first + 1;
+    while (last < net->len && net->activisions[last - 1] == NONE)
+    {
+        const size_t mid = net->layers[last - 1]->len;
+        const size_t out = net->layers[last]->len;
+        if (out * in > mid * in + mid * out)
+        {
+            break;
+        }
+        last++;
+    }
+    return last;
+}
+
+COGNI_DEF Network* cog_network_optimize(const Network* net, const float* scale, const float* shift)
+{
+    size_t* sizes          = cog_malloc(sizeof(size_t) * (net->len + 1), COG_MEM_OTHER);
+    Activision_type* types = cog_malloc(sizeof(Activision_type) * net->len, COG_MEM_OTHER);
+    const size_t width     = cog_network_max_width(net);
+    // ping pong [w | b] of the merged layer so far
+    float* merged = cog_malloc(sizeof(float) * 2 * width * (width + 1), COG_MEM_ACTIVATIONS);
+    if (sizes == NULL || types == NULL || merged == NULL)
+    {
+        fprintf(stderr, "ERROR: could not malloc network optimize data\n");
+        cog_free(sizes);
+        cog_free(types);
+        cog_free(merged);
+        return NULL;
+    }
+
+    size_t len = 0;
+    sizes[0]   = cog_network_in_features(net);
+    for (size_t first = 0; first < net->len; first = cog_mergeable_until(net, first))
+    {
+        const size_t last = cog_mergeable_until(net, first);
+        sizes[len + 1]    = net->layers[last - 1]->len;
+        types[len]        = net->activisions[last - 1];
+        len++;
+    }
+
+    Network* optimized = cog_network_init(sizes, types, len);
+    if (optimized == NULL)
+    {
+        cog_free(sizes);
+        cog_free(types);
+        cog_free(merged);
+        return NULL;
+    }
+
+    size_t layer = 0;
+    for (size_t first = 0; first < net->len; first = cog_mergeable_until(net, first), layer++)
+    {
+        const size_t last = cog_mergeable_until(net, first);
+        const size_t in   = net->layers[first]->neurons[0].w_len;
+        float* w          = merged;
+        float* next_w     = merged + width * (width + 1);
+        size_t out        = net->layers[first]->len;
+        memcpy(w, net->layers[first]->neurons[0].w, sizeof(float) * out * (in + 1));
+
+        for (size_t l = first + 1; l < last; l++)
+        {
+            // w2 * (w * x + b) + b2 = (w2 * w) * x + (w2 * b + b2)
+            const size_t next_out = net->layers[l]->len;
+            const float* w2       = net->layers[l]->neurons[0].w;
+            const float* b2       = net->layers[l]->neurons[0].b;
+            float* next_b         = next_w + next_out * in;
+            memcpy(next_b, b2, sizeof(float) * next_out);
+            cog_gemm(false, false, next_out, in, out, 1, w2, out, w, in, 0, next_w, in);
+            cog_gemm(false, false, next_out, 1, out, 1, w2, out, w + out * in, 1, 1, next_b, 1);
+
+            float* tmp = w;
+            w          = next_w;
+            next_w     = tmp;
+            out        = next_out;
+        }
+        memcpy(optimized->layers[layer]->neurons[0].w, w, sizeof(float) * out * (in + 1));
+    }
+
+    if (scale != NULL && shift != NULL)
+    {
+        cog_layer_fold_input_affine(optimized->layers[0], scale, shift);
+    }
+
+    cog_free(sizes);
+    cog_free(types);
+    cog_free(merged);
+    return optimized;
+}
+
+COGNI_DEF error cog_network_write(const char* path, const Network* net)
+{
+    FILE* fp = fopen(path, "w");
+    if (fp == 0)
+    {
+        fprintf(stderr, "could not open file '%s': %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    // layers_len, the sizes, the activisions and then the weights of every layer
+    error err = fprintf(fp, "%zu\n%zu ", net->len, cog_network_in_features(net)) < 0;
+    for (size_t i = 0; i < net->len; i++)
+    {
+        err |= fprintf(fp, "%zu ", net->layers[i]->len) < 0;
+    }
+    err |= fprintf(fp, "\n") < 0;
+    for (size_t i = 0; i < net->len; i++)
+    {
+        err |= fprintf(fp, "%d ", (int)net->activisions[i]) < 0;
+    }
+    err |= fprintf(fp, "\n") < 0;
+
+    for (size_t i = 0; i < net->len && err == 0; i++)
+    {
+        const LayerFC* layer = net->layers[i];
+        err                  = cog_write_weights_p(fp, layer->neurons[0].w,
+                                                   layer->len * layer->neurons[0].w_len,
+                                                   layer->neurons[0].b, layer->len);
+    }
+
+    // a full disk shows up when the buffer is flushed
+    err |= fclose(fp) != 0;
+    if (err != 0)
+    {
+        fprintf(stderr, "ERROR: could not write network file '%s'\n", path);
+    }
+    return err;
+}
+
+COGNI_DEF Network* cog_network_read(const char* path)
+{
+    FILE* fp = fopen(path, "r");
+    if (fp == 0)
+    {
+        fprintf(stderr, "could not open file '%s': %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    size_t len = 0;
+    if (fscanf(fp, "%zu\n", &len) != 1 || len == 0)
+    {
+        fprintf(stderr, "ERROR: network file '%s' is corrupted\n", path);
+        fclose(fp);
+        return NULL;
+    }
+    size_t* sizes          = cog_malloc(sizeof(size_t) * (len + 1), COG_MEM_OTHER);
+    Activision_type* types = cog_malloc(sizeof(Activision_type) * len, COG_MEM_OTHER);
+    if (sizes == NULL || types == NULL)
+    {
+        fprintf(stderr, "ERROR: could not malloc network data\n");
+        fclose(fp);
+        cog_free(sizes);
+        cog_free(types);
+        return NULL;
+    }
+
+    bool valid = true;
+    for (size_t i = 0; i < len + 1 && valid; i++)
+    {
+        valid = fscanf(fp, "%zu ", &sizes[i]) == 1 && sizes[i] > 0;
+    }
+    for (size_t i = 0; i < len && valid; i++)
+    {
+        int type = 0;
+        valid    = fscanf(fp, "%d ", &type) == 1 && type >= 0 && type < ACTIVISION_LEN;
+        types[i] = (Activision_type)type;
+    }
+
+    Network* net = valid ? cog_network_init(sizes, types, len) : NULL;
+    if (!valid)
+    {
+        fprintf(stderr, "ERROR: network file '%s' is corrupted\n", path);
+    }
+    error err = 0;
+    for (size_t i = 0; net != NULL && i < len && err == 0; i++)
+    {
+        const LayerFC* layer = net->layers[i];
+        const size_t w_len   = layer->len * layer->neurons[0].w_len;
+        err = cog_read_weights_p(fp, layer->neurons[0].w, w_len, layer->neurons[0].b, layer->len);
+    }
+    if (err != 0)
+    {
+        fprintf(stderr, "ERROR: network file '%s' is truncated\n", path);
+        cog_network_destroy(net);
+        net = NULL;
+    }
+
+    fclose(fp);
+    cog_free(sizes);
+    cog_free(types);
+    return net;
+}
+
+COGNI_DEF LayerContext* cog_layer_context_init(const LayerFC* layer)
+{
+    LayerContext* ctx = cog_malloc(sizeof(LayerContext), COG_MEM_OTHER);
+    if (ctx == NULL)
+    {
+        fprintf(stderr, "ERROR: could not malloc layer context\n");
+        return NULL;
+    }
+
+    const size_t in = layer->neurons[0].w_len;
+    ctx->inputs     = NULL;
+    ctx->outputs    = NULL;
+    ctx->batch_size = 0;
+    ctx->params_len = (in + 1) * layer->len;
+    ctx->dw         = cog_calloc(ctx->params_len, sizeof(float), COG_MEM_GRADIENTS);
+    if (ctx->dw == NULL)
+    {
+        fprintf(stderr, "ERROR: could not malloc layer context gradients\n");
+        cog_free(ctx);
+        return NULL;
+    }
+    ctx->db = &ctx->dw[in * layer->len];
+    return ctx;
+}
+
+COGNI_DEF void cog_layer_context_destroy(LayerContext* ctx)
+{
+    if (ctx == NULL)
+    {
+        return;
+    }
+    cog_free(ctx->dw);
+    cog_free(ctx);
+}
+
+COGNI_DEF void cog_layer_forward(const LayerFC* layer, Activision_type type, LayerContext* ctx,
+                                 const float* xs, float* ys, size_t batch_size)
+{
+    cog_layer_run_batch(layer, xs, ys, batch_size);
+    cog_activate_array(type, ys, batch_size * layer->len);
+    ctx->inputs     = xs;
+    ctx->outputs    = ys;
+    ctx->batch_size = batch_size;
+}
+
+COGNI_DEF void cog_layer_backward(const LayerFC* layer, Activision_type type, LayerContext* ctx,
+                                  float* deltas, float* grad_in)
+{
+    cog_linear_backward(layer, type, ctx->inputs, ctx->outputs, deltas, grad_in, ctx->dw, ctx->db,
+                        ctx->batch_size);
+}
+
+COGNI_DEF void cog_layer_context_zero_grad(LayerContext* ctx)
+{
+    memset(ctx->dw, 0, (sizeof *ctx->dw) * ctx->params_len);
+}
+
+COGNI_DEF void cog_layer_context_apply(LayerFC* layer, const LayerContext* ctx, float lr)
+{
+    // [w | b] and [dw | db] have the same layout
+    cog_apply_derives(layer->neurons[0].w, ctx->dw, ctx->params_len, NULL, NULL, 0, lr);
+}
+
+COGNI_DEF NetworkContext* cog_network_context_init(const Network* net, size_t max_batch)
+{
+    size_t activations_len = 0;
+    for (size_t l = 0; l < net->len; l++)
+    {
+        activations_len += net->layers[l]->len;
+    }
+    const size_t width = cog_network_max_width(net);
+
+    NetworkContext* ctx = cog_malloc(sizeof(NetworkContext), COG_MEM_OTHER);
+    if (ctx == NULL)
+    {
+        fprintf(stderr, "ERROR: could not malloc network context\n");
+        return NULL;
+    }
+    ctx->len         = 0;
+    ctx->max_batch   = max_batch;
+    ctx->layers      = cog_malloc(sizeof(LayerContext*) * net->len, COG_MEM_OTHER);
+    ctx->activations = cog_malloc(sizeof(float) * max_batch * (activations_len + 2 * width),
+                                  COG_MEM_ACTIVATIONS);
+    if (ctx->layers == NULL || ctx->activations == NULL)
+    {
+        fprintf(stderr, "ERROR: could not malloc network context data\n");
+        cog_network_context_destroy(ctx);
+        return NULL;
+    }
+    ctx->deltas[0] = &ctx->activations[max_batch * activations_len];
+    ctx->deltas[1] = &ctx->activations[max_batch * (activations_len + width)];
+
+    for (size_t l = 0; l < net->len; l++)
+    {
+        ctx->layers[l] = cog_layer_context_init(net->layers[l]);
+        if (ctx->layers[l] == NULL)
+        {
+            cog_network_context_destroy(ctx);
+            return NULL;
+        }
+        ctx->len++;
+    }
+    return ctx;
+}
+
+COGNI_DEF void cog_network_context_destroy(NetworkContext* ctx)
+{
+    if (ctx == NULL)
+    {
+        return;
+    }
+    for (size_t l = 0; l < ctx->len; l++)
+    {
+        cog_layer_context_destroy(ctx->layers[l]);
+    }
+    cog_free(ctx->layers);
+    cog_free(ctx->activations);
+    cog_free(ctx);
+}
+
+COGNI_DEF float* cog_network_forward(const Network* net, NetworkContext* ctx, const float* xs,
+                                     size_t batch_size)
+{
+    if (batch_size > ctx->max_batch)
+    {
+        fprintf(stderr, "ERROR: batch %zu is bigger then the context %zu\n", batch_size,
+                ctx->max_batch);
+        return NULL;
+    }
+    float* ys = ctx->activations;
+    for (size_t l = 0; l < net->len; l++)
+    {
+        cog_layer_forward(net->layers[l], net->activisions[l], ctx->layers[l], xs, ys, batch_size);
+        xs = ys;
+        ys += batch_size * net->layers[l]->len;
+    }
+    return (float*)xs;
+}
+
+COGNI_DEF void cog_network_backward(const Network* net, NetworkContext* ctx,
+                                    const float* partial_derive)
+{
+    const size_t batch_size = ctx->layers[net->len - 1]->batch_size;
+    float* deltas           = ctx->deltas[0];
+    memcpy(deltas, partial_derive, (sizeof *deltas) * batch_size * cog_network_out_features(net));
+    for (size_t l = net->len; l-- > 0;)
+    {
+        float* grad_in = (l > 0) ? ctx->deltas[(net->len - l) % 2] : NULL;
+        cog_layer_backward(net->layers[l], net->activisions[l], ctx->layers[l], deltas, grad_in);
+        deltas = grad_in;
+    }
+}
+
+COGNI_DEF void cog_network_context_zero_grad(NetworkContext* ctx)
+{
+    for (size_t l = 0; l < ctx->len; l++)
+    {
+        cog_layer_context_zero_grad(ctx->layers[l]);
+    }
+}
+
+COGNI_DEF void cog_network_context_apply(Network* net, const NetworkContext* ctx, float lr)
+{
+    for (size_t l = 0; l < net->len; l++)
+    {
+        cog_layer_context_apply(net->layers[l], ctx->layers[l], lr);
+    }
+}
+
+/* Orthogonalize the rows of a [m x n] using one sided jacobi rotations while keeping
+   a_orig = u * a, u is [m x m]. after it the norms of the rows are the singular values */
+static void cog_jacobi_rows(double* a, size_t m, size_t n, double* u)
+{
+    const size_t max_sweeps = 60;
+    const double eps        = 1e-12;
+
+    memset(u, 0, (sizeof *u) * m * m);
+    for (size_t i = 0; i < m; i++)
+    {
+        u[i * m + i] = 1;
+    }
+
+    for (size_t sweep = 0; sweep < max_sweeps; sweep++)
+    {
+        bool rotated = false;
+        for (size_t p = 0; p + 1 < m; p++)
+        {
+            for (size_t q = p + 1; q < m; q++)
+            {
+                double* ap   = &a[p * n];
+                double* aq   = &a[q * n];
+                double alpha = 0, beta = 0, gamma = 0;
+                for (size_t k = 0; k < n; k++)
+                {
+                    alpha += ap[k] * ap[k];
+                    beta += aq[k] * aq[k];
+                    gamma += ap[k] * aq[k];
+                }
+                if (fabs(gamma) <= eps * sqrt(alpha * beta) || gamma == 0)
+                {
+                    continue;
+                }
+                rotated = true;
+
+                const double zeta = (beta - alpha) / (2 * gamma);
+                const double t    = ((zeta >= 0) ? 1 : -1) / (fabs(zeta) + sqrt(1 + zeta * zeta));
+                const double c    = 1 / sqrt(1 + t * t);
+                const double s    = c * t;
+                for (size_t k = 0; k < n; k++)
+                {
+                    const double xp = ap[k];
+                    const double xq = aq[k];
+                    ap[k]           = c * xp - s * xq;
+                    aq[k]           = s * xp + c * xq;
+                }
+                for (size_t k = 0; k < m; k++)
+                {
+                    const double up = u[k * m + p];
+                    const double uq = u[k * m + q];
+                    u[k * m + p]    = c * up - s * uq;
+                    u[k * m + q]    = s * up + c * uq;
+                }
+            }
+        }
+        if (!rotated)
+        {
+            break;
+        }
+    }
+}
+
+/* Fill order with the rows of a [m x n] sorted by descending norm and norms with the squared norm */
+static void cog_sort_rows_by_norm(const double* a, size_t m, size_t n, size_t* order,
+                                  double* norms)
+{
+    for (size_t i = 0; i < m; i++)
+    {
+        order[i] = i;
+        norms[i] = 0;
+        for (size_t k = 0; k < n; k++)
+        {
+            norms[i] += a[i * n + k] * a[i * n + k];
+        }
+    }
+    // insertion sort - m is the rank, small
+    for (size_t i = 1; i < m; i++)
+    {
+        const size_t cur = order[i];
+        size_t j         = i;
+        for (; j > 0 && norms[order[j - 1]] < norms[cur]; j--)
+        {
+            order[j] = order[j - 1];
+        }
+        order[j] = cur;
+    }
+}
+
+/* Modified gram schmidt on the columns of y [m x k] */
+static void cog_orthonormalize_columns(double* y, size_t m, size_t k)
+{
+    for (size_t j = 0; j < k; j++)
+    {
+        for (size_t prev = 0; prev < j; prev++)
+        {
+            double dot = 0;
+            for (size_t i = 0; i < m; i++)
+            {
+                dot += y[i * k + j] * y[i * k + prev];
+            }
+            for (size_t i = 0; i < m; i++)
+            {
+                y[i * k + j] -= dot * y[i * k + prev];
+            }
+        }
+        double norm = 0;
+        for (size_t i = 0; i < m; i++)
+        {
+            norm += y[i * k + j] * y[i * k + j];
+        }
+        norm = sqrt(norm);
+        for (size_t i = 0; i < m; i++)
+        {
+            y[i * k + j] = (norm > 0) ? y[i * k + j] / norm : 0;
+        }
+    }
+}
+
+/* Randomized range finder: w ~= q * b where q is [m x k] orthonormal and b = q^T * w is [k x n] */
+static void cog_range_finder(const float* w, size_t m, size_t n, size_t k, double* q, double* b)
+{
+    // b is used as the [n x k] random test matrix before it is overwritten
+    for (size_t i = 0; i < n * k; i++)
+    {
+        b[i] = ((double)rand() / (double)RAND_MAX) * 2 - 1;
+    }
+    for (size_t i = 0; i < m; i++)
+    {
+        for (size_t j = 0; j < k; j++)
+        {
+            double sum = 0;
+            for (size_t l = 0; l < n; l++)
+            {
+                sum += w[i * n + l] * b[l * k + j];
+            }
+            q[i * k + j] = sum;
+        }
+    }
+    cog_orthonormalize_columns(q, m, k);
+
+    // one power iteration: q = orth(w * w^T * q) sharpens the decaying spectrum
+    for (size_t l = 0; l < n; l++)
+    {
+        for (size_t j = 0; j < k; j++)
+        {
+            double sum = 0;
+            for (size_t i = 0; i < m; i++)
+            {
+                sum += w[i * n + l] * q[i * k + j];
+            }
+            b[l * k + j] = sum;
+        }
+    }
+    for (size_t i = 0; i < m; i++)
+    {
+        for (size_t j = 0; j < k; j++)
+        {
+            double sum = 0;
+            for (size_t l = 0; l < n; l++)
+            {
+                sum += w[i * n + l] * b[l * k + j];
+            }
+            q[i * k + j] = sum;
+        }
+    }
+    cog_orthonormalize_columns(q, m, k);
+
+    for (size_t j = 0; j < k; j++)
+    {
+        for (size_t l = 0; l < n; l++)
+        {
+            double sum = 0;
+            for (size_t i = 0; i < m; i++)
+            {
+                sum += q[i * k + j] * w[i * n + l];
+            }
+            b[j * n + l] = sum;
+        }
+    }
+}
+
+COGNI_DEF NetworkPlan* cog_network_plan_init(const Network* net, size_t max_batch)
+{
+    NetworkPlan* plan = cog_malloc(sizeof(NetworkPlan), COG_MEM_OTHER);
+    if (plan == NULL)
+    {
+        fprintf(stderr, "ERROR: could not malloc plan\n");
+        return NULL;
+    }
+
+    // the widest layer decides the size, no matter how deep the network is
+    plan->width      = cog_network_max_width(net);
+    plan->max_batch  = max_batch;
+    plan->buffers[0] = cog_malloc(sizeof(float) * 2 * plan->width * max_batch, COG_MEM_ACTIVATIONS);
+    if (plan->buffers[0] == NULL)
+    {
+        fprintf(stderr, "ERROR: could not malloc plan buffers\n");
+        cog_free(plan);
+        return NULL;
+    }
+    plan->buffers[1] = plan->buffers[0] + plan->width * max_batch;
+
+    return plan;
+}
+
+COGNI_DEF void cog_network_plan_destroy(NetworkPlan* plan)
+{
+    if (plan == NULL)
+    {
+        return;
+    }
+    cog_free(plan->buffers[0]);
+    cog_free(plan);
+}
+
+COGNI_DEF float* cog_network_plan_run(const Network* net, NetworkPlan* plan, const float* xs,
+                                      size_t batch_size)
+{
+    if (batch_size > plan->max_batch)
+    {
+        fprintf(stderr, "ERROR: batch %zu is bigger then the plan %zu\n", batch_size,
+                plan->max_batch);
+        return NULL;
+    }
+    return cog_network_run_batch(net, xs, batch_size, plan->buffers[0]);
+}
+
+/* xorshift32 - every model needs its own reproducible stream */
+static float cog_rand_seeded(unsigned* state)
+{
+    unsigned x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return (float)(x >> 8) / (float)(1u << 24);
+}
+
+COGNI_DEF ModelBatch* cog_model_batch_init(const size_t* sizes, const Activision_type* activisions,
+                                           size_t layers_len, size_t models,
+                                           const unsigned* seeds)
+{
+    ModelBatch* batch = cog_calloc(1, sizeof(ModelBatch), COG_MEM_OTHER);
+    if (batch == NULL)
+    {
+        fprintf(stderr, "ERROR: could not malloc model batch\n");
+        return NULL;
+    }
+
+    size_t max_width = sizes[0];
+    for (size_t l = 0; l <= layers_len; l++)
+    {
+        max_width = (sizes[l] > max_width) ? sizes[l] : max_width;
+    }
+
+    batch->models      = models;
+    batch->layers_len  = layers_len;
+    batch->sizes       = cog_malloc(sizeof(size_t) * (layers_len + 1), COG_MEM_OTHER);
+    batch->activisions = cog_malloc(sizeof(Activision_type) * layers_len, COG_MEM_OTHER);
+    batch->lr          = cog_malloc(sizeof(float) * models, COG_MEM_OTHER);
+    batch->w           = cog_calloc(layers_len, sizeof(float*), COG_MEM_OTHER);
+    batch->b           = cog_calloc(layers_len, sizeof(float*), COG_MEM_OTHER);
+    batch->dw          = cog_calloc(layers_len, sizeof(float*), COG_MEM_OTHER);
+    batch->db          = cog_calloc(layers_len, sizeof(float*), COG_MEM_OTHER);
+    batch->outputs     = cog_calloc(layers_len, sizeof(float*), COG_MEM_OTHER);
+    batch->deltas      = cog_calloc(layers_len, sizeof(float*), COG_MEM_OTHER);
+    batch->inputs      = cog_malloc(sizeof(float) * sizes[0] * models, COG_MEM_ACTIVATIONS);
+
+    bool failed = batch->sizes == NULL || batch->activisions == NULL || batch->lr == NULL ||
+                  batch->w == NULL || batch->b == NULL || batch->dw == NULL || batch->db == NULL ||
+                  batch->outputs == NULL || batch->deltas == NULL || batch->inputs == NULL;
+    for (size_t l = 0; l < layers_len && !failed; l++)
+    {
+        const size_t w_len = sizes[l] * sizes[l + 1] * models;
+        const size_t b_len = sizes[l + 1] * models;
+        batch->w[l]        = cog_malloc(sizeof(float) * w_len, COG_MEM_PARAMETERS);
+        batch->b[l]        = cog_malloc(sizeof(float) * b_len, COG_MEM_PARAMETERS);
+        batch->dw[l]       = cog_calloc(w_len, sizeof(float), COG_MEM_GRADIENTS);
+        batch->db[l]       = cog_calloc(b_len, sizeof(float), COG_MEM_GRADIENTS);
+        batch->outputs[l]  = cog_malloc(sizeof(float) * b_len, COG_MEM_ACTIVATIONS);
+        batch->deltas[l]   = cog_malloc(sizeof(float) * max_width * models, COG_MEM_ACTIVATIONS);
+
+        failed = batch->w[l] == NULL || batch->b[l] == NULL || batch->dw[l] == NULL ||
+                 batch->db[l] == NULL || batch->outputs[l] == NULL || batch->deltas[l] == NULL;
+    }
+    if (failed)
+    {
+        fprintf(stderr, "ERROR: could not malloc model batch data\n");
+        cog_model_batch_destroy(batch);
+        return NULL;
+    }
+
+    memcpy(batch->sizes, sizes, sizeof(size_t) * (layers_len + 1));
+    memcpy(batch->activisions, activisions, sizeof(Activision_type) * layers_len);
+    for (size_t k = 0; k < models; k++)
+    {
+        batch->lr[k] = 0.001f;
+
+        // same ranges as cog_layer_init, from the model own seed
+        unsigned state = (seeds != NULL && seeds[k] != 0) ? seeds[k] : (unsigned)(k + 1);
+        for (size_t l = 0; l < layers_len; l++)
+        {
+            for (size_t e = 0; e < sizes[l] * sizes[l + 1]; e++)
+            {
+                batch->w[l][e * models + k] = cog_rand_seeded(&state);
+            }
+            for (size_t e = 0; e < sizes[l + 1]; e++)
+            {
+                batch->b[l][e * models + k] = cog_rand_seeded(&state);
+            }
+        }
+    }
+
+    return batch;
+}
+
+COGNI_DEF void cog_model_batch_destroy(ModelBatch* batch)
+{
+    if (batch == NULL)
+    {
+        return;
+    }
+    for (size_t l = 0; l < batch->layers_len; l++)
+    {
+        if (batch->w != NULL)
+        {
+            cog_free(batch->w[l]);
+        }
+        if (batch->b != NULL)
+        {
+            cog_free(batch->b[l]);
+        }
+        if (batch->dw != NULL)
+        {
+            cog_free(batch->dw[l]);
+        }
+        if (batch->db != NULL)
+        {
+            cog_free(batch->db[l]);
+        }
+        if (batch->outputs != NULL)
+        {
+            cog_free(batch->outputs[l]);
+        }
+        if (batch->deltas != NULL)
+        {
+            cog_free(batch->deltas[l]);
+        }
+    }
+    cog_free(batch->sizes);
+    cog_free(batch->activisions);
+    cog_free(batch->lr);
+    cog_free(batch->w);
+    cog_free(batch->b);
+    cog_free(batch->dw);
+    cog_free(batch->db);
+    cog_free(batch->inputs);
+    cog_free(batch->outputs);
+    cog_free(batch->deltas);
+    cog_free(batch);
+}
+
+COGNI_DEF float* cog_model_batch_run(ModelBatch* batch, const float* xs)
+{
+    const size_t models = batch->models;
+    for (size_t i = 0; i < batch->sizes[0]; i++)
+    {
+        for (size_t k = 0; k < models; k++)
+        {
+            batch->inputs[i * models + k] = xs[i];
+        }
+    }
+
+    const float* in_act = batch->inputs;
+    for (size_t l = 0; l < batch->layers_len; l++)
+    {
+        const size_t in  = batch->sizes[l];
+        const size_t out = batch->sizes[l + 1];
+        const float* w   = batch->w[l];
+        float* out_act   = batch->outputs[l];
+
+        const activision fun = c_activision_index[batch->activisions[l]].fun;
+
+        memcpy(out_act, batch->b[l], sizeof(float) * out * models);
+        for (size_t n = 0; n < out; n++)
+        {
+            for (size_t i = 0; i < in; i++)
+            {
+                // one lane per model
+                const float* w_lane = &w[(n * in + i) * models];
+                const float* x_lane = &in_act[i * models];
+                for (size_t k = 0; k < models; k++)
+                {
+                    out_act[n * models + k] += w_lane[k] * x_lane[k];
+                }
+            }
+        }
+        if (fun != NULL)
+        {
+            for (size_t e = 0; e < out * models; e++)
+            {
+                out_act[e] = fun(out_act[e]);
+            }
+        }
+        in_act = out_act;
+    }
+
+    return batch->outputs[batch->layers_len - 1];
+}
+
+COGNI_DEF void cog_model_batch_zero_grad(ModelBatch* batch)
+{
+    for (size_t l = 0; l < batch->layers_len; l++)
+    {
+        const size_t out = batch->sizes[l + 1];
+        memset(batch->dw[l], 0, sizeof(float) * batch->sizes[l] * out * batch->models);
+        memset(batch->db[l], 0, sizeof(float) * out * batch->models);
+    }
+}
+
+COGNI_DEF void cog_model_batch_backpropagate_batch(ModelBatch* batch, const float* partial_derive,
+                                                   size_t batch_size)
+{
+    const size_t models = batch->models;
+    const float scale   = 1.f / batch_size;
+    const size_t last   = batch->layers_len - 1;
+    memcpy(batch->deltas[last], partial_derive, sizeof(float) * batch->sizes[last + 1] * models);
+
+    for (size_t l = last + 1; l-- > 0;)
+    {
+        const size_t in     = batch->sizes[l];
+        const size_t out    = batch->sizes[l + 1];
+        const float* w      = batch->w[l];
+        const float* in_act = (l == 0) ? batch->inputs : batch->outputs[l - 1];
+        float* delta        = batch->deltas[l];
+
+        const activision fun_derive = c_activision_index[batch->activisions[l]].fun_derive;
+
+        if (fun_derive != NULL)
+        {
+            for (size_t e = 0; e < out * models; e++)
+            {
+                delta[e] *= fun_derive(batch->outputs[l][e]);
+            }
+        }
+
+        for (size_t n = 0; n < out; n++)
+        {
+            const float* d_lane = &delta[n * models];
+            for (size_t k = 0; k < models; k++)
+            {
+                batch->db[l][n * models + k] += d_lane[k] * scale;
+            }
+            for (size_t i = 0; i < in; i++)
+            {
+                float* dw_lane      = &batch->dw[l][(n * in + i) * models];
+                const float* x_lane = &in_act[i * models];
+                for (size_t k = 0; k < models; k++)
+                {
+                    dw_lane[k] += d_lane[k] * x_lane[k] * scale;
+                }
+            }
+        }
+
+        if (l == 0)
+        {
+            break;
+        }
+        float* prev = batch->deltas[l - 1];
+        memset(prev, 0, sizeof(float) * in * models);
+        for (size_t n = 0; n < out; n++)
+        {
+            const float* d_lane = &delta[n * models];
+            for (size_t i = 0; i < in; i++)
+            {
+                const float* w_lane = &w[(n * in + i) * models];
+                for (size_t k = 0; k < models; k++)
+                {
+                    prev[i * models + k] += d_lane[k] * w_lane[k];
+                }
+            }
+        }
+    }
+}
+
+COGNI_DEF void cog_model_batch_apply_derives(ModelBatch* batch)
+{
+    const size_t models = batch->models;
+    for (size_t l = 0; l < batch->layers_len; l++)
+    {
+        const size_t out = batch->sizes[l + 1];
+        for (size_t e = 0; e < batch->sizes[l] * out; e++)
+        {
+            for (size_t k = 0; k < models; k++)
+            {
+                batch->w[l][e * models + k] -= batch->lr[k] * batch->dw[l][e * models + k];
+            }
+        }
+        for (size_t e = 0; e < out; e++)
+        {
+            for (size_t k = 0; k < models; k++)
+            {
+                batch->b[l][e * models + k] -= batch->lr[k] * batch->db[l][e * models + k];
+            }
+        }
+    }
+}
+
+COGNI_DEF void cog_model_batch_export(const ModelBatch* batch, size_t model, Network* net)
+{
+    const size_t models = batch->models;
+    for (size_t l = 0; l < batch->layers_len; l++)
+    {
+        LayerFC* layer = net->layers[l];
+        for (size_t e = 0; e < batch->sizes[l] * batch->sizes[l + 1]; e++)
+        {
+            layer->neurons[0].w[e] = batch->w[l][e * models + model];
+        }
+        for (size_t e = 0; e < batch->sizes[l + 1]; e++)
+        {
+            layer->neurons[0].b[e] = batch->b[l][e * models + model];
+        }
+    }
+}
+
+COGNI_DEF void cog_model_batch_import(ModelBatch* batch, size_t model, const Network* net)
+{
+    const size_t models = batch->models;
+    for (size_t l = 0; l < batch->layers_len; l++)
+    {
+        const LayerFC* layer = net->layers[l];
+        for (size_t e = 0; e < batch->sizes[l] * batch->sizes[l + 1]; e++)
+        {
+            batch->w[l][e * models + model] = layer->neurons[0].w[e];
+        }
+        for (size_t e = 0; e < batch->sizes[l + 1]; e++)
+        {
+            batch->b[l][e * models + model] = layer->neurons[0].b[e];
+        }
+    }
+}
+
+/* Copy the factors out of the jacobi result: first = kept rows of a, second = (q *) u columns */
+static void cog_fill_lowrank(LayerLowRank* r, const LayerFC* layer, Factor_type type,
+                             const double* a, const double* u, const double* q, size_t m,
+                             const size_t* order)
+{
+    const size_t out = layer->len;
+    const size_t in  = layer->neurons[0].w_len;
+    for (size_t k = 0; k < r->rank; k++)
+    {
+        for (size_t l = 0; l < in; l++)
+        {
+            r->first->neurons[k].w[l] = (float)a[order[k] * in + l];
+        }
+        *r->first->neurons[k].b = 0;
+    }
+    for (size_t o = 0; o < out; o++)
+    {
+        for (size_t k = 0; k < r->rank; k++)
+        {
+            double sum = 0;
+            if (type == COG_FACTOR_RANDOMIZED)
+            {
+                for (size_t j = 0; j < m; j++)
+                {
+                    sum += q[o * m + j] * u[j * m + order[k]];
+                }
+            }
+            else
+            {
+                sum = u[o * m + order[k]];
+            }
+            r->second->neurons[o].w[k] = (float)sum;
+        }
+        *r->second->neurons[o].b = *layer->neurons[o].b;
+    }
+}
+
+/* Relative frobenius error between the layer weights and the product of the factors */
+static float cog_lowrank_error(const LayerLowRank* r, const LayerFC* layer)
+{
+    const size_t out = layer->len;
+    const size_t in  = layer->neurons[0].w_len;
+    const float* w   = layer->neurons[0].w;
+    double diff = 0, total = 0;
+    for (size_t o = 0; o < out; o++)
+    {
+        for (size_t l = 0; l < in; l++)
+        {
+            double approx = 0;
+            for (size_t k = 0; k < r->rank; k++)
+            {
+                approx += (double)r->second->neurons[o].w[k] * r->first->neurons[k].w[l];
+            }
+            diff += COGNI_POW2(w[o * in + l] - approx);
+            total += COGNI_POW2((double)w[o * in + l]);
+        }
+    }
+    return (total > 0) ? (float)sqrt(diff / total) : 0;
+}
+
+COGNI_DEF LayerLowRank* cog_layer_factorize(const LayerFC* layer, size_t rank, Factor_type type,
+                                            float* rel_error)
+{
+    const size_t out = layer->len;
+    const size_t in  = layer->neurons[0].w_len;
+    const float* w   = layer->neurons[0].w;
+    if (rank == 0 || rank > out || rank > in || type >= COG_FACTOR_LEN)
+    {
+        fprintf(stderr, "ERROR: rank %zu is not valid for layer [%zu x %zu]\n", rank, out, in);
+        return NULL;
+    }
+
+    // m is the number of rows that are being orthogonalized
+    size_t m = out;
+    if (type == COG_FACTOR_RANDOMIZED)
+    {
+        const size_t oversample = 8;
+        m                       = (rank + oversample < out) ? rank + oversample : out;
+    }
+
+    double* a       = cog_malloc(sizeof(double) * m * ((in > out) ? in : out), COG_MEM_OTHER);
+    double* u       = cog_malloc(sizeof(double) * m * m, COG_MEM_OTHER);
+    double* q       = cog_malloc(sizeof(double) * out * m, COG_MEM_OTHER);
+    double* norms   = cog_malloc(sizeof(double) * m, COG_MEM_OTHER);
+    size_t* order   = cog_malloc(sizeof(size_t) * m, COG_MEM_OTHER);
+    LayerLowRank* r = cog_malloc(sizeof(LayerLowRank), COG_MEM_OTHER);
+    if (a == NULL || u == NULL || q == NULL || norms == NULL || order == NULL || r == NULL)
+    {
+        fprintf(stderr, "ERROR: could not malloc factorization data\n");
+        cog_free(a);
+        cog_free(u);
+        cog_free(q);
+        cog_free(norms);
+        cog_free(order);
+        cog_free(r);
+        return NULL;
+    }
+
+    if (type == COG_FACTOR_RANDOMIZED)
+    {
+        cog_range_finder(w, out, in, m, q, a);
+    }
+    else
+    {
+        for (size_t i = 0; i < out * in; i++)
+        {
+            a[i] = w[i];
+        }
+    }
+    cog_jacobi_rows(a, m, in, u);
+    cog_sort_rows_by_norm(a, m, in, order, norms);
+
+    r->rank        = rank;
+    r->first       = cog_layer_init(in, rank);
+    r->second      = cog_layer_init(rank, out);
+    r->part_derive = cog_malloc(sizeof(float) * rank, COG_MEM_ACTIVATIONS);
+    if (r->first == NULL || r->second == NULL || r->part_derive == NULL)
+    {
+        cog_layer_lowrank_destroy(r);
+        r = NULL;
+    }
+    else
+    {
+        cog_fill_lowrank(r, layer, type, a, u, q, m, order);
+        if (rel_error != NULL)
+        {
+            *rel_error = cog_lowrank_error(r, layer);
+        }
+    }
+
+    cog_free(a);
+    cog_free(u);
+    cog_free(q);
+    cog_free(norms);
+    cog_free(order);
+    return r;
+}
+
+COGNI_DEF void cog_layer_lowrank_destroy(LayerLowRank* layer)
+{
+    if (layer == NULL)
+    {
+        return;
+    }
+    if (layer->first != NULL)
+    {
+        cog_layer_destroy(layer->first);
+    }
+    if (layer->second != NULL)
+    {
+        cog_layer_destroy(layer->second);
+    }
+    cog_free(layer->part_derive);
+    cog_free(layer);
+}
+
+COGNI_DEF float* cog_layer_lowrank_run(LayerLowRank* layer, const float* xs)
+{
+    cog_layer_run(layer->first, xs);
+    return cog_layer_run(layer->second, layer->first->outputs);
+}
+
+COGNI_DEF void cog_layer_lowrank_zero_grad(LayerLowRank* layer)
+{
+    cog_layer_zero_grad(layer->first);
+    cog_layer_zero_grad(layer->second);
+}
+
+COGNI_DEF void cog_layer_lowrank_backpropagate_batch(LayerLowRank* layer,
+                                                     const float* partial_derive,
+                                                     size_t batch_size)
+{
+    cog_layer_backpropagate_batch(layer->second, partial_derive, batch_size);
+    cog_layer_part_derive(layer->second);
+    // part_derive of second is [out x rank], every output adds to the derive of the first outputs
+    memset(layer->part_derive, 0, (sizeof *layer->part_derive) * layer->rank);
+    for (size_t o = 0; o < layer->second->len; o++)
+    {
+        for (size_t k = 0; k < layer->rank; k++)
+        {
+            layer->part_derive[k] += layer->second->part_derive[o * layer->rank + k];
+        }
+    }
+    cog_layer_backpropagate_batch(layer->first, layer->part_derive, batch_size);
+}
+
+COGNI_DEF void cog_layer_lowrank_apply_derives(LayerLowRank* layer, float lr)
+{
+    cog_layer_apply_derives(layer->first, lr);
+    cog_layer_apply_derives(layer->second, lr);
+}
+
+COGNI_DEF error cog_layer_rank_errors(const LayerFC* layer, float* errors, size_t errors_len)
+{
+    const size_t out = layer->len;
+    const size_t in  = layer->neurons[0].w_len;
+
+    double* a     = cog_malloc(sizeof(double) * out * in, COG_MEM_OTHER);
+    double* u     = cog_malloc(sizeof(double) * out * out, COG_MEM_OTHER);
+    double* norms = cog_malloc(sizeof(double) * out, COG_MEM_OTHER);
+    size_t* order = cog_malloc(sizeof(size_t) * out, COG_MEM_OTHER);
+    if (a == NULL || u == NULL || norms == NULL || order == NULL)
+    {
+        fprintf(stderr, "ERROR: could not malloc factorization data\n");
+        cog_free(a);
+        cog_free(u);
+        cog_free(norms);
+        cog_free(order);
+        return 1;
+    }
+
+    for (size_t i = 0; i < out * in; i++)
+    {
+        a[i] = layer->neurons[0].w[i];
+    }
+    cog_jacobi_rows(a, out, in, u);
+    cog_sort_rows_by_norm(a, out, in, order, norms);
+
+    double total = 0;
+    for (size_t i = 0; i < out; i++)
+    {
+        total += norms[i];
+    }
+    for (size_t r = 0; r < errors_len; r++)
+    {
+        // the error of rank r + 1 is the energy of the dropped singular values
+        double dropped = 0;
+        for (size_t i = r + 1; i < out; i++)
+        {
+            dropped += norms[order[i]];
+        }
+        errors[r] = (total > 0) ? (float)sqrt(dropped / total) : 0;
+    }
+
+    cog_free(a);
+    cog_free(u);
+    cog_free(norms);
+    cog_free(order);
+    return 0;
+}
+
+COGNI_DEF LayerEmbedding* cog_embedding_init(size_t vocab, size_t dim)
+{
+    LayerEmbedding* layer = cog_malloc(sizeof(LayerEmbedding), COG_MEM_OTHER);
+    if (layer == NULL)
+    {
+        fprintf(stderr, "ERROR: could not malloc embedding\n");
+        return NULL;
+    }
+
+    layer->vocab       = vocab;
+    layer->dim         = dim;
+    layer->touched_len = 0;
+    layer->w           = cog_malloc(sizeof(float) * vocab * dim, COG_MEM_PARAMETERS);
+    layer->dw          = cog_calloc(vocab * dim, sizeof(float), COG_MEM_GRADIENTS);
+    layer->touched     = cog_malloc(sizeof(size_t) * vocab, COG_MEM_GRADIENTS);
+    layer->is_touched  = cog_calloc(vocab, sizeof(bool), COG_MEM_GRADIENTS);
+    if (layer->w == NULL || layer->dw == NULL || layer->touched == NULL ||
+        layer->is_touched == NULL)
+    {
+        fprintf(stderr, "ERROR: could not malloc embedding data\n");
+        cog_embedding_destroy(layer);
+        return NULL;
+    }
+
+    cog_array_rand_f(layer->w, vocab * dim, 0, 1);
+    return layer;
+}
+
+COGNI_DEF void cog_embedding_destroy(LayerEmbedding* layer)
+{
+    if (layer == NULL)
+    {
+        return;
+    }
+    cog_free(layer->w);
+    cog_free(layer->dw);
+    cog_free(layer->touched);
+    cog_free(layer->is_touched);
+    cog_free(layer);
+}
+
+COGNI_DEF error cog_embedding_run(const LayerEmbedding* layer, const size_t* ids, float* ys,
+                                  size_t batch_size)
+{
+    for (size_t i = 0; i < batch_size; i++)
+    {
+        if (ids[i] >= layer->vocab)
+        {
+            fprintf(stderr, "ERROR: id %zu is out of the embedding vocab %zu\n", ids[i],
+                    layer->vocab);
+            return 1;
+        }
+        memcpy(&ys[i * layer->dim], &layer->w[ids[i] * layer->dim], sizeof(float) * layer->dim);
+    }
+    return 0;
+}
+
+COGNI_DEF error cog_embedding_backward(LayerEmbedding* layer, const size_t* ids,
+                                       const float* deltas, size_t batch_size)
+{
+    for (size_t i = 0; i < batch_size; i++)
+    {
+        if (ids[i] >= layer->vocab)
+        {
+            fprintf(stderr, "ERROR: id %zu is out of the embedding vocab %zu\n", ids[i],
+                    layer->vocab);
+            return 1;
+        }
+    }
+
+    const float scale = 1.f / batch_size;
+    for (size_t i = 0; i < batch_size; i++)
+    {
+        const size_t id = ids[i];
+        if (!layer->is_touched[id])
+        {
+            layer->is_touched[id]                = true;
+            layer->touched[layer->touched_len++] = id;
+        }
+
+        float* dw = &layer->dw[id * layer->dim];
+        for (size_t d = 0; d < layer->dim; d++)
+        {
+            dw[d] += deltas[i * layer->dim + d] * scale;
+        }
+    }
+    return 0;
+}
+
+COGNI_DEF void cog_embedding_zero_grad(LayerEmbedding* layer)
+{
+    for (size_t i = 0; i < layer->touched_len; i++)
+    {
+        const size_t id = layer->touched[i];
+        memset(&layer->dw[id * layer->dim], 0, sizeof(float) * layer->dim);
+        layer->is_touched[id] = false;
+    }
+    layer->touched_len = 0;
+}
+
+COGNI_DEF void cog_embedding_apply_derives(LayerEmbedding* layer, float lr)
+{
+    for (size_t i = 0; i < layer->touched_len; i++)
+    {
+        const size_t row = layer->touched[i] * layer->dim;
+        cog_apply_derives(&layer->w[row], &layer->dw[row], layer->dim, NULL, NULL, 0, lr);
+    }
+}
+
+COGNI_DEF error cog_checkpoint_resume(const char* path, LayerFC** layers, size_t layers_len,
+                                      size_t* step)
+{
+    FILE* fp = fopen(path, "r");
+    if (fp == 0)
+    {
+        fprintf(stderr, "could not open file '%s': %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    // the step, the layers and their shapes must match before anything is read
+    size_t saved_step = 0;
+    size_t saved_len  = 0;
+    size_t params_len = 0;
+    bool valid        = fscanf(fp, "%zu\n%zu\n", &saved_step, &saved_len) == 2 &&
+                 saved_len == layers_len;
+    for (size_t i = 0; i < layers_len && valid; i++)
+    {
+        size_t in = 0, out = 0;
+        valid = fscanf(fp, "%zu %zu\n", &in, &out) == 2 && in == layers[i]->neurons[0].w_len &&
+                out == layers[i]->len;
+        params_len += (in + 1) * out;
+    }
+    if (!valid)
+    {
+        fprintf(stderr, "ERROR: checkpoint '%s' does not match the layers\n", path);
+        fclose(fp);
+        return 1;
+    }
+
+    // a truncated file leaves the layers as they were
+    float* params = cog_malloc(sizeof(float) * params_len, COG_MEM_PARAMETERS);
+    error err     = (params == NULL);
+    float* pos    = params;
+    for (size_t i = 0; i < layers_len && err == 0; i++)
+    {
+        const size_t w_len = layers[i]->len * layers[i]->neurons[0].w_len;
+        err                = cog_read_weights_p(fp, pos, w_len, pos + w_len, layers[i]->len);
+        pos += w_len + layers[i]->len;
+    }
+    fclose(fp);
+    if (err != 0)
+    {
+        fprintf(stderr, "ERROR: checkpoint '%s' is corrupted\n", path);
+        cog_free(params);
+        return 1;
+    }
+
+    pos = params;
+    for (size_t i = 0; i < layers_len; i++)
+    {
+        const size_t len = cog_layer_params_len(layers[i]);
+        memcpy(layers[i]->neurons[0].w, pos, (sizeof *pos) * len);
+        pos += len;
+    }
+    cog_free(params);
+
+    if (step != NULL)
+    {
+        *step = saved_step;
+    }
+    return 0;
+}
+
+#ifdef COGNI_THREADS
+static error cog_checkpoint_write(Checkpoint* checkpoint)
+{
+    FILE* fp = fopen(checkpoint->tmp_path, "w");
+    if (fp == 0)
+    {
+        fprintf(stderr, "could not open file '%s': %s\n", checkpoint->tmp_path, strerror(errno));
+        return 1;
+    }
+
+    error err = fprintf(fp, "%zu\n%zu\n", checkpoint->step, checkpoint->layers_len) < 0;
+    for (size_t i = 0; i < checkpoint->layers_len; i++)
+    {
+        // [in x out] of the layer
+        err |= fprintf(fp, "%zu %zu\n", checkpoint->w_lens[i] / checkpoint->b_lens[i],
+                       checkpoint->b_lens[i]) < 0;
+    }
+    const float* pos = checkpoint->staging;
+    for (size_t i = 0; i < checkpoint->layers_len; i++)
+    {
+        err |= cog_write_weights_p(fp, pos, checkpoint->w_lens[i], pos + checkpoint->w_lens[i],
+                                   checkpoint->b_lens[i]);
+        pos += checkpoint->w_lens[i] + checkpoint->b_lens[i];
+    }
+
+    // the rename is atomic only if the data is already on the disk
+    err |= fflush(fp) != 0;
+#if defined(__unix__) || defined(__APPLE__)
+    err |= fsync(fileno(fp)) != 0;
+#endif
+    err |= fclose(fp) != 0;
+    if (err != 0)
+    {
+        // a short write must not replace the last good checkpoint
+        fprintf(stderr, "ERROR: could not write checkpoint '%s'\n", checkpoint->tmp_path);
+        remove(checkpoint->tmp_path);
+        return 1;
+    }
+    if (rename(checkpoint->tmp_path, checkpoint->path) != 0)
+    {
+        fprintf(stderr, "ERROR: could not rename '%s': %s\n", checkpoint->tmp_path,
+                strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+static int cog_checkpoint_writer(void* arg)
+{
+    Checkpoint* checkpoint = arg;
+    cog_set_allocator(checkpoint->allocator);
+    mtx_lock(&checkpoint->lock);
+    while (true)
+    {
+        while (!checkpoint->pending && !checkpoint->stop)
+        {
+            cnd_wait(&checkpoint->cond, &checkpoint->lock);
+        }
+        if (!checkpoint->pending)
+        {
+            break;
+        }
+
+        // the staging buffer is not touched by save while pending is set
+        mtx_unlock(&checkpoint->lock);
+        error err = cog_checkpoint_write(checkpoint);
+        mtx_lock(&checkpoint->lock);
+
+        checkpoint->last_error = err;
+        checkpoint->pending    = false;
+        cnd_broadcast(&checkpoint->cond);
+    }
+    mtx_unlock(&checkpoint->lock);
+    return 0;
+}
+
+static void cog_checkpoint_free(Checkpoint* checkpoint)
+{
+    cog_free(checkpoint->path);
+    cog_free(checkpoint->tmp_path);
+    cog_free(checkpoint->staging);
+    cog_free(checkpoint->w_lens);
+    cog_free(checkpoint->b_lens);
+    cog_free(checkpoint);
+}
+
+COGNI_DEF Checkpoint* cog_checkpoint_init(const char* path, LayerFC** layers, size_t layers_len)
+{
+    Checkpoint* checkpoint = cog_malloc(sizeof(Checkpoint), COG_MEM_OTHER);
+    if (checkpoint == NULL)
+    {
+        fprintf(stderr, "ERROR: could not malloc checkpoint\n");
+        return NULL;
+    }
+
+    size_t staging_len = 0;
+    for (size_t i = 0; i < layers_len; i++)
+    {
+        staging_len += cog_layer_params_len(layers[i]);
+    }
+
+    const size_t path_len  = strlen(path);
+    checkpoint->path       = cog_malloc(path_len + 1, COG_MEM_OTHER);
+    checkpoint->tmp_path   = cog_malloc(path_len + sizeof(".tmp"), COG_MEM_OTHER);
+    checkpoint->staging    = cog_malloc(sizeof(float) * staging_len, COG_MEM_PARAMETERS);
+    checkpoint->w_lens     = cog_malloc(sizeof(size_t) * layers_len, COG_MEM_OTHER);
+    checkpoint->b_lens     = cog_malloc(sizeof(size_t) * layers_len, COG_MEM_OTHER);
+    checkpoint->layers_len = layers_len;
+    checkpoint->step       = 0;
+    checkpoint->pending    = false;
+    checkpoint->stop       = false;
+    checkpoint->last_error = 0;
+    if (checkpoint->path == NULL || checkpoint->tmp_path == NULL || checkpoint->staging == NULL ||
+        checkpoint->w_lens == NULL || checkpoint->b_lens == NULL)
+    {
+        fprintf(stderr, "ERROR: could not malloc checkpoint data\n");
+        cog_checkpoint_free(checkpoint);
+        return NULL;
+    }
+
+    memcpy(checkpoint->path, path, path_len + 1);
+    memcpy(checkpoint->tmp_path, path, path_len);
+    memcpy(checkpoint->tmp_path + path_len, ".tmp", sizeof(".tmp"));
+    for (size_t i = 0; i < layers_len; i++)
+    {
+        checkpoint->w_lens[i] = layers[i]->len * layers[i]->neurons[0].w_len;
+        checkpoint->b_lens[i] = layers[i]->len;
+    }
+
+    if (mtx_init(&checkpoint->lock, mtx_plain) != thrd_success)
+    {
+        fprintf(stderr, "ERROR: could not init the checkpoint lock\n");
+        cog_checkpoint_free(checkpoint);
+        return NULL;
+    }
+    if (cnd_init(&checkpoint->cond) != thrd_success)
+    {
+        fprintf(stderr, "ERROR: could not init the checkpoint condition\n");
+        mtx_destroy(&checkpoint->lock);
+        cog_checkpoint_free(checkpoint);
+        return NULL;
+    }
+    checkpoint->allocator = cog_get_allocator();
+    if (thrd_create(&checkpoint->writer, cog_checkpoint_writer, checkpoint) != thrd_success)
+    {
+        fprintf(stderr, "ERROR: could not start checkpoint writer\n");
+        checkpoint->stop = true;
+        cog_checkpoint_destroy(checkpoint);
+        return NULL;
+    }
+
+    return checkpoint;
+}
+
+COGNI_DEF error cog_checkpoint_save(Checkpoint* checkpoint, LayerFC** layers, size_t step)
+{
+    mtx_lock(&checkpoint->lock);
+    // blocks only when the previous checkpoint is still being written
+    while (checkpoint->pending)
+    {
+        cnd_wait(&checkpoint->cond, &checkpoint->lock);
+    }
+
+    float* pos = checkpoint->staging;
+    for (size_t i = 0; i < checkpoint->layers_len; i++)
+    {
+        const size_t len = checkpoint->w_lens[i] + checkpoint->b_lens[i];
+        memcpy(pos, layers[i]->neurons[0].w, (sizeof *pos) * len);
+        pos += len;
+    }
+    checkpoint->step    = step;
+    checkpoint->pending = true;
+    error err           = checkpoint->last_error;
+
+    cnd_broadcast(&checkpoint->cond);
+    mtx_unlock(&checkpoint->lock);
+    return err;
+}
+
+COGNI_DEF error cog_checkpoint_wait(Checkpoint* checkpoint)
+{
+    mtx_lock(&checkpoint->lock);
+    while (checkpoint->pending)
+    {
+        cnd_wait(&checkpoint->cond, &checkpoint->lock);
+    }
+    error err = checkpoint->last_error;
+    mtx_unlock(&checkpoint->lock);
+    return err;
+}
+
+COGNI_DEF void cog_checkpoint_destroy(Checkpoint* checkpoint)
+{
+    if (checkpoint == NULL)
+    {
+        return;
+    }
+
+    mtx_lock(&checkpoint->lock);
+    const bool running = !checkpoint->stop;
+    checkpoint->stop   = true;
+    cnd_broadcast(&checkpoint->cond);
+    mtx_unlock(&checkpoint->lock);
+    if (running)
+    {
+        // the writer finishes the pending checkpoint before exiting
+        thrd_join(checkpoint->writer, NULL);
+    }
+
+    mtx_destroy(&checkpoint->lock);
+    cnd_destroy(&checkpoint->cond);
+    cog_checkpoint_free(checkpoint);
+}
+
+COGNI_DEF ModelPublisher* cog_publisher_init(const Network* net, size_t slots_len)
+{
+    ModelPublisher* publisher = cog_malloc(sizeof(ModelPublisher), COG_MEM_OTHER);
+    if (publisher == NULL)
+    {
+        fprintf(stderr, "ERROR: could not malloc publisher\n");
+        return NULL;
+    }
+
+    // one slot is read while another is written, more slots let slow readers hold old versions
+    slots_len              = (slots_len < 2) ? 2 : slots_len;
+    publisher->layers_len  = net->len;
+    publisher->slots_len   = slots_len;
+    publisher->params_len  = cog_network_params_len(net);
+    publisher->sizes       = cog_malloc(sizeof(size_t) * (net->len + 1), COG_MEM_OTHER);
+    publisher->activisions = cog_malloc(sizeof(Activision_type) * net->len, COG_MEM_OTHER);
+    publisher->slots       = cog_calloc(slots_len, sizeof(ModelSnapshot), COG_MEM_OTHER);
+    if (publisher->sizes == NULL || publisher->activisions == NULL || publisher->slots == NULL)
+    {
+        fprintf(stderr, "ERROR: could not malloc publisher data\n");
+        cog_publisher_destroy(publisher);
+        return NULL;
+    }
+
+    publisher->sizes[0] = cog_network_in_features(net);
+    for (size_t i = 0; i < net->len; i++)
+    {
+        publisher->sizes[i + 1]   = net->layers[i]->len;
+        publisher->activisions[i] = net->activisions[i];
+    }
+    for (size_t i = 0; i < slots_len; i++)
+    {
+        publisher->slots[i].params =
+            cog_malloc(sizeof(float) * publisher->params_len, COG_MEM_PARAMETERS);
+        if (publisher->slots[i].params == NULL)
+        {
+            fprintf(stderr, "ERROR: could not malloc publisher data\n");
+            cog_publisher_destroy(publisher);
+            return NULL;
+        }
+        atomic_init(&publisher->slots[i].readers, 0);
+    }
+
+    // the last slot stands for version 0 so the first version goes to slot 0, nobody reads yet
+    atomic_init(&publisher->current, &publisher->slots[slots_len - 1]);
+    if (cog_publisher_publish(publisher, net) != 0)
+    {
+        fprintf(stderr, "ERROR: could not publish the first version\n");
+        cog_publisher_destroy(publisher);
+        return NULL;
+    }
+    return publisher;
+}
+
+COGNI_DEF void cog_publisher_destroy(ModelPublisher* publisher)
+{
+    if (publisher == NULL)
+    {
+        return;
+    }
+    for (size_t i = 0; publisher->slots != NULL && i < publisher->slots_len; i++)
+    {
+        cog_free(publisher->slots[i].params);
+    }
+    cog_free(publisher->sizes);
+    cog_free(publisher->activisions);
+    cog_free(publisher->slots);
+    cog_free(publisher);
+}
+
+COGNI_DEF error cog_publisher_publish(ModelPublisher* publisher, const Network* net)
+{
+    ModelSnapshot* current   = atomic_load(&publisher->current);
+    ModelSnapshot* free_slot = NULL;
+    for (size_t i = 0; i < publisher->slots_len && free_slot == NULL; i++)
+    {
+        // a reader that comes after this check sees the slot is not current and retries
+        ModelSnapshot* slot = &publisher->slots[i];
+        if (slot != current && atomic_load(&slot->readers) == 0)
+        {
+            free_slot = slot;
+        }
+    }
+    if (free_slot == NULL)
+    {
+        return 1;
+    }
+
+    cog_network_get_params(net, free_slot->params);
+    free_slot->version = current->version + 1;
+
+    atomic_store(&publisher->current, free_slot);
+    return 0;
+}
+
+COGNI_DEF const ModelSnapshot* cog_publisher_acquire(ModelPublisher* publisher)
+{
+    while (true)
+    {
+        ModelSnapshot* snapshot = atomic_load(&publisher->current);
+        atomic_fetch_add(&snapshot->readers, 1);
+        // still current after the count is visible, the trainer will not reuse it
+        if (atomic_load(&publisher->current) == snapshot)
+        {
+            return snapshot;
+        }
+        atomic_fetch_sub(&snapshot->readers, 1);
+    }
+}
+
+COGNI_DEF void cog_publisher_release(ModelPublisher* publisher, const ModelSnapshot* snapshot)
+{
+    UNUSED(publisher);
+    atomic_fetch_sub(&((ModelSnapshot*)snapshot)->readers, 1);
+}
+
+COGNI_DEF float* cog_snapshot_run(const ModelPublisher* publisher, const ModelSnapshot* snapshot,
+                                  const float* xs, float* scratch)
+{
+    size_t width = publisher->sizes[0];
+    for (size_t i = 0; i <= publisher->layers_len; i++)
+    {
+        width = (publisher->sizes[i] > width) ? publisher->sizes[i] : width;
+    }
+
+    float* buffers[2] = {scratch, scratch + width};
+    const float* w    = snapshot->params;
+    float* ys         = NULL;
+    for (size_t l = 0; l < publisher->layers_len; l++)
+    {
+        const size_t in  = publisher->sizes[l];
+        const size_t out = publisher->sizes[l + 1];
+        const float* b   = w + in * out;
+        ys               = buffers[l % 2];
+        for (size_t n = 0; n < out; n++)
+        {
+            ys[n] = cog_calculate_linear(&w[n * in], xs, in, b[n]);
+        }
+        cog_activate_array(publisher->activisions[l], ys, out);
+        xs = ys;
+        w  = b + out;
+    }
+    return ys;
+}
+
+/* The private state of a hogwild thread, the weights are the only shared thing */
+typedef struct HogwildWorker
+{
+    Network* net;
+    const float* xs;
+    const float* ys;
+    size_t stride;
+    size_t rows;
+    size_t samples; // per epoch, drawn uniformly from all the rows
+    unsigned seed;
+    size_t epochs;
+    float lr;
+
+    NetworkContext* ctx; // the weights are shared, only the activations are private
+    float* partial_derive;
+    float loss;
+    Allocator allocator; // of the caller
+} HogwildWorker;
+
+/* Apply the gradient of one sample and zero it. a row of dw is delta * x so a neuron with a zero
+   delta has nothing to apply or zero, the cost follows the gradients and not the parameters */
+static void cog_hogwild_apply(LayerFC* layer, LayerContext* ctx, float lr)
+{
+    const size_t in = layer->neurons[0].w_len;
+    for (size_t n = 0; n < layer->len; n++)
+    {
+        if (ctx->db[n] == 0)
+        {
+            continue;
+        }
+        // racy on purpose: a lost update between threads is tolerated. sparse inputs have zero
+        // gradients and touch only their own weights
+        float* w  = &layer->neurons[0].w[n * in];
+        float* dw = &ctx->dw[n * in];
+        for (size_t i = 0; i < in; i++)
+        {
+            if (dw[i] != 0)
+            {
+                w[i] -= lr * dw[i];
+                dw[i] = 0;
+            }
+        }
+        layer->neurons[0].b[n] -= lr * ctx->db[n];
+        ctx->db[n] = 0;
+    }
+}
+
+static int cog_hogwild_worker(void* arg)
+{
+    HogwildWorker* worker = arg;
+    Network* net          = worker->net;
+    const size_t out_len  = cog_network_out_features(net);
+    cog_set_allocator(worker->allocator);
+
+    for (size_t epoch = 0; epoch < worker->epochs; epoch++)
+    {
+        worker->loss = 0;
+        for (size_t sample_i = 0; sample_i < worker->samples; sample_i++)
+        {
+            const size_t row   = (size_t)(cog_rand_seeded(&worker->seed) * worker->rows);
+            const float* pred  = cog_network_forward(net, worker->ctx,
+                                                     &worker->xs[row * worker->stride], 1);
+            const float* truth = &worker->ys[row * worker->stride];
+            for (size_t n = 0; n < out_len; n++)
+            {
+                worker->loss += cog_mse(truth[n], pred[n]);
+                worker->partial_derive[n] = cog_mse_deriv(truth[n], pred[n]);
+            }
+
+            // the context gradients start at zero and every apply zeroes what it used
+            cog_network_backward(net, worker->ctx, worker->partial_derive);
+            for (size_t l = 0; l < net->len; l++)
+            {
+                cog_hogwild_apply(net->layers[l], worker->ctx->layers[l], worker->lr);
+            }
+        }
+    }
+    return 0;
+}
+
+COGNI_DEF error cog_network_train_hogwild(Network* net, const float* xs, const float* ys,
+                                          size_t stride, size_t rows, size_t epochs, float lr,
+                                          size_t threads_len, float* loss)
+{
+    const size_t out_len = cog_network_out_features(net);
+
+    threads_len            = (threads_len == 0) ? 1 : threads_len;
+    HogwildWorker* workers = cog_calloc(threads_len, sizeof(HogwildWorker), COG_MEM_OTHER);
+    thrd_t* threads        = cog_malloc(sizeof(thrd_t) * threads_len, COG_MEM_OTHER);
+    float* partial_derives = cog_malloc(sizeof(float) * threads_len * out_len, COG_MEM_ACTIVATIONS);
+    error err              = (workers == NULL || threads == NULL || partial_derives == NULL);
+    for (size_t t = 0; t < threads_len && err == 0; t++)
+    {
+        workers[t].ctx = cog_network_context_init(net, 1);
+        err            = (workers[t].ctx == NULL);
+    }
+    if (err != 0)
+    {
+        fprintf(stderr, "ERROR: could not malloc hogwild workers\n");
+    }
+
+    size_t started = 0;
+    for (size_t t = 0; t < threads_len && err == 0; t++)
+    {
+        workers[t].net            = net;
+        workers[t].xs             = xs;
+        workers[t].ys             = ys;
+        workers[t].stride         = stride;
+        workers[t].rows           = rows;
+        workers[t].samples        = (rows + threads_len - 1 - t) / threads_len;
+        workers[t].seed           = (unsigned)(t + 1) * 2654435761u;
+        workers[t].epochs         = epochs;
+        workers[t].lr             = lr;
+        workers[t].partial_derive = &partial_derives[t * out_len];
+        workers[t].allocator      = cog_get_allocator();
+        if (thrd_create(&threads[t], cog_hogwild_worker, &workers[t]) != thrd_success)
+        {
+            fprintf(stderr, "ERROR: could not start hogwild thread\n");
+            err = 1;
+            break;
+        }
+        started++;
+    }
+
+    float total = 0;
+    for (size_t t = 0; t < started; t++)
+    {
+        thrd_join(threads[t], NULL);
+        total += workers[t].loss;
+    }
+    if (loss != NULL)
+    {
+        *loss = total / rows;
+    }
+
+    for (size_t t = 0; workers != NULL && t < threads_len; t++)
+    {
+        cog_network_context_destroy(workers[t].ctx);
+    }
+    cog_free(workers);
+    cog_free(threads);
+    cog_free(partial_derives);
+    return err;
+}
+
+/* The state of a data parallel thread, the chunks (or the shards) are taken in any order */
+typedef struct ParallelWorker
+{
+    const Network* net;
+    const float* xs;
+    const float* ys;
+    size_t stride;
+    size_t rows;
+    atomic_size_t* next;
+
+    NetworkContext* ctx;
+    float* inputs;         // [COGNI_REDUCE_CHUNK x in] the rows of the chunk
+    float* partial_derive; // [COGNI_REDUCE_CHUNK x out]
+    float loss;
+
+    // deterministic mode: the [dw | db] of every layer and the loss of every shard
+    size_t shards;
+    float* shard_grads;
+    float* shard_losses;
+    size_t params_len;
+    Allocator allocator; // of the caller
+} ParallelWorker;
+
+/* forward and backward of one chunk into the context gradients, returns the chunk loss */
+static float cog_parallel_chunk(ParallelWorker* worker, size_t chunk)
+{
+    const Network* net   = worker->net;
+    NetworkContext* ctx  = worker->ctx;
+    const size_t in      = cog_network_in_features(net);
+    const size_t out_len = cog_network_out_features(net);
+    const size_t first   = chunk * COGNI_REDUCE_CHUNK;
+    const size_t len     = (worker->rows - first < COGNI_REDUCE_CHUNK) ? worker->rows - first
+                                                                       : COGNI_REDUCE_CHUNK;
+    for (size_t i = 0; i < len; i++)
+    {
+        memcpy(&worker->inputs[i * in], &worker->xs[(first + i) * worker->stride],
+               (sizeof *worker->inputs) * in);
+    }
+    const float* pred = cog_network_forward(net, ctx, worker->inputs, len);
+
+    // the backward averages over the chunk, scaled to the part of the chunk in all the rows
+    // the chunks just add up
+    const float part = (float)len / worker->rows;
+    float loss       = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        const float* truth = &worker->ys[(first + i) * worker->stride];
+        for (size_t n = 0; n < out_len; n++)
+        {
+            loss += cog_mse(truth[n], pred[i * out_len + n]);
+            worker->partial_derive[i * out_len + n] =
+                cog_mse_deriv(truth[n], pred[i * out_len + n]) * part;
+        }
+    }
+    cog_network_backward(net, ctx, worker->partial_derive);
+    return loss;
+}
+
+static int cog_parallel_worker(void* arg)
+{
+    ParallelWorker* worker = arg;
+    NetworkContext* ctx    = worker->ctx;
+    const size_t chunks    = (worker->rows + COGNI_REDUCE_CHUNK - 1) / COGNI_REDUCE_CHUNK;
+    cog_set_allocator(worker->allocator);
+
+    if (worker->shard_grads == NULL)
+    {
+        size_t chunk;
+        while ((chunk = atomic_fetch_add(worker->next, 1)) < chunks)
+        {
+            worker->loss += cog_parallel_chunk(worker, chunk);
+        }
+        return 0;
+    }
+
+    // a shard is a run of chunks added in order, its bounds depend only on rows
+    size_t shard;
+    while ((shard = atomic_fetch_add(worker->next, 1)) < worker->shards)
+    {
+        const size_t first = shard * chunks / worker->shards;
+        const size_t last  = (shard + 1) * chunks / worker->shards;
+        float loss         = 0;
+        cog_network_context_zero_grad(ctx);
+        for (size_t chunk = first; chunk < last; chunk++)
+        {
+            loss += cog_parallel_chunk(worker, chunk);
+        }
+
+        float* grads = &worker->shard_grads[shard * worker->params_len];
+        for (size_t l = 0; l < ctx->len; l++)
+        {
+            memcpy(grads, ctx->layers[l]->dw, (sizeof *grads) * ctx->layers[l]->params_len);
+            grads += ctx->layers[l]->params_len;
+        }
+        worker->shard_losses[shard] = loss;
+    }
+    return 0;
+}
+
+COGNI_DEF error cog_network_train_step_parallel(Network* net, const float* xs, const float* ys,
+                                                size_t stride, size_t rows, float lr,
+                                                size_t threads_len, float* loss)
+{
+    if (rows == 0)
+    {
+        fprintf(stderr, "ERROR: no rows to train on\n");
+        return 1;
+    }
+    const size_t in         = cog_network_in_features(net);
+    const size_t out_len    = cog_network_out_features(net);
+    const size_t chunks     = (rows + COGNI_REDUCE_CHUNK - 1) / COGNI_REDUCE_CHUNK;
+    const size_t shards     = (chunks < COGNI_REDUCE_SHARDS) ? chunks : COGNI_REDUCE_SHARDS;
+    const size_t params_len = cog_network_params_len(net);
+
+    threads_len             = (threads_len == 0) ? 1 : threads_len;
+    ParallelWorker* workers = cog_calloc(threads_len, sizeof(ParallelWorker), COG_MEM_OTHER);
+    thrd_t* threads         = cog_malloc(sizeof(thrd_t) * threads_len, COG_MEM_OTHER);
+    float* buffers = cog_malloc(sizeof(float) * threads_len * COGNI_REDUCE_CHUNK * (in + out_len),
+                                COG_MEM_ACTIVATIONS);
+    // [shard_grads | shard_losses]
+    float* shard_grads =
+        c_deterministic ? cog_malloc(sizeof(float) * shards * (params_len + 1), COG_MEM_GRADIENTS)
+                        : NULL;
+    error err = (workers == NULL || threads == NULL || buffers == NULL ||
+                 (c_deterministic && shard_grads == NULL));
+    for (size_t t = 0; t < threads_len && err == 0; t++)
+    {
+        workers[t].ctx = cog_network_context_init(net, COGNI_REDUCE_CHUNK);
+        err            = (workers[t].ctx == NULL);
+    }
+    if (err != 0)
+    {
+        fprintf(stderr, "ERROR: could not malloc data parallel workers\n");
+    }
+
+    atomic_size_t next;
+    atomic_init(&next, 0);
+    size_t started = 0;
+    for (size_t t = 0; t < threads_len && err == 0; t++)
+    {
+        float* buffer             = &buffers[t * COGNI_REDUCE_CHUNK * (in + out_len)];
+        workers[t].net            = net;
+        workers[t].xs             = xs;
+        workers[t].ys             = ys;
+        workers[t].stride         = stride;
+        workers[t].rows           = rows;
+        workers[t].next           = &next;
+        workers[t].inputs         = buffer;
+        workers[t].partial_derive = buffer + COGNI_REDUCE_CHUNK * in;
+        workers[t].shards         = shards;
+        workers[t].shard_grads    = shard_grads;
+        workers[t].shard_losses   = c_deterministic ? &shard_grads[shards * params_len] : NULL;
+        workers[t].params_len     = params_len;
+        workers[t].allocator      = cog_get_allocator();
+        if (thrd_create(&threads[t], cog_parallel_worker, &workers[t]) != thrd_success)
+        {
+            fprintf(stderr, "ERROR: could not start data parallel thread\n");
+            err = 1;
+            break;
+        }
+        started++;
+    }
+    for (size_t t = 0; t < started; t++)
+    {
+        thrd_join(threads[t], NULL);
+    }
+
+    if (err == 0 && c_deterministic)
+    {
+        cog_reduce_tree(shard_grads, shards, params_len);
+        cog_reduce_tree(workers[0].shard_losses, shards, 1);
+        float* grads = shard_grads;
+        for (size_t l = 0; l < net->len; l++)
+        {
+            const size_t len = workers[0].ctx->layers[l]->params_len;
+            // [w | b] and [dw | db] have the same layout
+            cog_apply_derives(net->layers[l]->neurons[0].w, grads, len, NULL, NULL, 0, lr);
+            grads += len;
+        }
+        workers[0].loss = workers[0].shard_losses[0];
+    }
+    else if (err == 0)
+    {
+        // in the order of the threads but every thread got other chunks
+        for (size_t t = 1; t < threads_len; t++)
+        {
+            for (size_t l = 0; l < net->len; l++)
+            {
+                LayerContext* dst       = workers[0].ctx->layers[l];
+                const LayerContext* src = workers[t].ctx->layers[l];
+                for (size_t i = 0; i < dst->params_len; i++)
+                {
+                    dst->dw[i] += src->dw[i];
+                }
+            }
+            workers[0].loss += workers[t].loss;
+        }
+        cog_network_context_apply(net, workers[0].ctx, lr);
+    }
+    if (err == 0 && loss != NULL)
+    {
+        *loss = workers[0].loss / rows;
+    }
+
+    for (size_t t = 0; workers != NULL && t < threads_len; t++)
+    {
+        cog_network_context_destroy(workers[t].ctx);
+    }
+    cog_free(shard_grads);
+    cog_free(buffers);
+    cog_free(threads);
+    cog_free(workers);
+    return err;
+}
+#endif // COGNI_THREADS
+
 COGNI_DEF void cog_print_array(float* array, size_t len, const char* format, ...)
 {
     va_list argptr;
@@ -4,11 +4,27 @@ set -e
 SOURCES=(
     ./compare_to_math.c
     ./busses.c
+    ./low_rank.c
+    ./checkpoint.c
+    ./server.c
+    ./plan.c
+    ./gemm.c
+    ./model_batch.c
+    ./normalize.c
+    ./online.c
+    ./hogwild.c
+    ./distributed.c
+    ./embedding.c
+    ./graph.c
+    ./context.c
+    ./tune.c
+    ./memory.c
+    ./deterministic.c
 )
 
 BUILD=./build/
 INCLUDE="-I../ -I../utils"
-LINK=-lm
+LINK="-lm -lpthread"
 CFLAGS="-Wall -Wextra -Wshadow -pedantic -g"
 # CFLAGS+=" -fno-omit-frame-pointer -fsanitize=address"
 
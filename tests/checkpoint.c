@@ -0,0 +1,158 @@
+#define COGNI_THREADS
+#define COGNI_IMPLEMENTATION
+#include "cogni.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LAYERS_LEN 3
+
+const char* g_filename = "build/checkpoint.w";
+const char* g_full     = "build/checkpoint_full.w";
+const char* g_full_tmp = "build/checkpoint_full.w.tmp";
+
+/* a write that fails must keep the last good checkpoint */
+static const char* test_full_disk(LayerFC** layers)
+{
+    // only where there is a device that is always full
+    if (access("/dev/full", W_OK) != 0)
+    {
+        return NULL;
+    }
+    unlink(g_full);
+    unlink(g_full_tmp);
+    Checkpoint* checkpoint = cog_checkpoint_init(g_full, layers, LAYERS_LEN);
+    if (checkpoint == NULL)
+    {
+        return "could not init the checkpoint";
+    }
+    error err = cog_checkpoint_save(checkpoint, layers, 1) | cog_checkpoint_wait(checkpoint);
+    // the next write goes to the full device
+    err |= symlink("/dev/full", g_full_tmp) != 0;
+    cog_checkpoint_save(checkpoint, layers, 2);
+    const bool write_failed = cog_checkpoint_wait(checkpoint) != 0;
+    cog_checkpoint_destroy(checkpoint);
+
+    size_t step = 0;
+    err |= cog_checkpoint_resume(g_full, layers, LAYERS_LEN, &step);
+    unlink(g_full_tmp);
+    if (err != 0)
+    {
+        return "could not write the first checkpoint";
+    }
+    if (!write_failed)
+    {
+        return "a write to a full disk did not fail";
+    }
+    return step == 1 ? NULL : "a failed write replaced the last good checkpoint";
+}
+
+int main(void)
+{
+    LayerFC* layers[LAYERS_LEN]  = {cog_layer_init(4, 8), cog_layer_init(8, 5),
+                                    cog_layer_init(5, 1)};
+    LayerFC* resumed[LAYERS_LEN] = {cog_layer_init(4, 8), cog_layer_init(8, 5),
+                                    cog_layer_init(5, 1)};
+
+    Checkpoint* checkpoint = cog_checkpoint_init(g_filename, layers, LAYERS_LEN);
+
+    float xs[4] = {1, 8, 1, 1};
+    float truth = 20;
+    float saved[LAYERS_LEN][8 * 5 + 5];
+    size_t saved_step = 0;
+    for (size_t step = 0; step < 100; step++)
+    {
+        cog_layer_run(layers[0], xs);
+        cog_layer_run(layers[1], layers[0]->outputs);
+        cog_layer_run(layers[2], layers[1]->outputs);
+
+        const float d_mse = cog_mse_deriv(truth, layers[2]->outputs[0]);
+        cog_layer_backpropagate(layers[2], &d_mse);
+        cog_layer_part_derive(layers[2]);
+        cog_layer_backpropagate(layers[1], layers[2]->part_derive);
+        cog_layer_part_derive(layers[1]);
+        cog_layer_backpropagate(layers[0], layers[1]->part_derive);
+        for (size_t i = 0; i < LAYERS_LEN; i++)
+        {
+            cog_layer_apply_derives(layers[i], 0.0001);
+        }
+
+        if (step % 10 == 0)
+        {
+            cog_checkpoint_save(checkpoint, layers, step);
+            saved_step = step;
+            for (size_t i = 0; i < LAYERS_LEN; i++)
+            {
+                memcpy(saved[i], layers[i]->neurons[0].w,
+                       sizeof(float) * cog_layer_params_len(layers[i]));
+            }
+        }
+    }
+    error err = cog_checkpoint_wait(checkpoint);
+    cog_checkpoint_destroy(checkpoint);
+
+    size_t step = 0;
+    err |= cog_checkpoint_resume(g_filename, resumed, LAYERS_LEN, &step);
+
+    const char* failed = NULL;
+    if (err != 0)
+    {
+        failed = "could not save and resume";
+    }
+    else if (step != saved_step)
+    {
+        failed = "the step was not restored";
+    }
+    for (size_t i = 0; i < LAYERS_LEN && failed == NULL; i++)
+    {
+        if (memcmp(saved[i], resumed[i]->neurons[0].w,
+                   sizeof(float) * cog_layer_params_len(resumed[i])) != 0)
+        {
+            failed = "the parameters are not the same as the snapshot";
+        }
+    }
+
+    // a broken or different checkpoint fails and keeps the layers
+    LayerFC* other[LAYERS_LEN] = {cog_layer_init(4, 8), cog_layer_init(8, 6),
+                                  cog_layer_init(6, 1)};
+    if (failed == NULL && cog_checkpoint_resume(g_filename, other, LAYERS_LEN, NULL) == 0)
+    {
+        failed = "resumed into layers of other shapes";
+    }
+    struct stat st;
+    if (failed == NULL &&
+        (stat(g_filename, &st) != 0 || truncate(g_filename, st.st_size / 2) != 0 ||
+         cog_checkpoint_resume(g_filename, resumed, LAYERS_LEN, NULL) == 0))
+    {
+        failed = "resumed from a truncated checkpoint";
+    }
+    for (size_t i = 0; i < LAYERS_LEN && failed == NULL; i++)
+    {
+        if (memcmp(saved[i], resumed[i]->neurons[0].w,
+                   sizeof(float) * cog_layer_params_len(resumed[i])) != 0)
+        {
+            failed = "a failed resume changed the layers";
+        }
+    }
+    if (failed == NULL)
+    {
+        failed = test_full_disk(layers);
+    }
+
+    for (size_t i = 0; i < LAYERS_LEN; i++)
+    {
+        cog_layer_destroy(layers[i]);
+        cog_layer_destroy(resumed[i]);
+        cog_layer_destroy(other[i]);
+    }
+
+    if (failed != NULL)
+    {
+        printf("\033[31m[-] %s test failed: %s\033[0m\n", __FILE__, failed);
+    }
+    else
+    {
+        printf("\033[32m[+] %s passed\033[0m\n", __FILE__);
+    }
+    return 0;
+}
@@ -0,0 +1,114 @@
+#define COGNI_THREADS
+#define COGNI_IMPLEMENTATION
+#include "cogni.h"
+
+#define LAYERS_LEN 3
+#define THREADS 4
+#define BATCH 16
+#define IN 12
+#define REPEATS 200
+
+typedef struct
+{
+    const Network* net;
+    NetworkContext* ctx;
+    const float* xs;
+    const float* partial_derive;
+    float outputs[BATCH];
+} Job;
+
+/* forward and backward of a private batch on the shared weights */
+static void run(Job* job)
+{
+    const float* ys = cog_network_forward(job->net, job->ctx, job->xs, BATCH);
+    memcpy(job->outputs, ys, sizeof job->outputs);
+    cog_network_context_zero_grad(job->ctx);
+    cog_network_backward(job->net, job->ctx, job->partial_derive);
+}
+
+static int thread_run(void* arg)
+{
+    for (size_t i = 0; i < REPEATS; i++)
+    {
+        run(arg);
+    }
+    return 0;
+}
+
+/* the gradients of the context, layer after layer */
+static bool same_grads(const NetworkContext* a, const NetworkContext* b)
+{
+    for (size_t l = 0; l < a->len; l++)
+    {
+        if (memcmp(a->layers[l]->dw, b->layers[l]->dw, sizeof(float) * a->layers[l]->params_len))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(void)
+{
+    srand(0);
+    const size_t sizes[LAYERS_LEN + 1]            = {IN, 32, 16, 1};
+    const Activision_type activisions[LAYERS_LEN] = {L_RELU, SIGMOID, NONE};
+    Network* net                                  = cog_network_init(sizes, activisions, LAYERS_LEN);
+
+    float xs[THREADS][BATCH * IN], partial_derive[THREADS][BATCH];
+    Job jobs[THREADS], expected[THREADS];
+    for (size_t t = 0; t < THREADS; t++)
+    {
+        cog_array_rand_f(xs[t], BATCH * IN, -1, 1);
+        cog_array_rand_f(partial_derive[t], BATCH, -1, 1);
+        jobs[t]         = (Job){.net            = net,
+                                .ctx            = cog_network_context_init(net, BATCH),
+                                .xs             = xs[t],
+                                .partial_derive = partial_derive[t]};
+        expected[t]     = jobs[t];
+        expected[t].ctx = cog_network_context_init(net, BATCH);
+        run(&expected[t]);
+    }
+
+    thrd_t threads[THREADS];
+    for (size_t t = 0; t < THREADS; t++)
+    {
+        thrd_create(&threads[t], thread_run, &jobs[t]);
+    }
+    for (size_t t = 0; t < THREADS; t++)
+    {
+        thrd_join(threads[t], NULL);
+    }
+
+    // the contexts must also agree with the plain batch runner
+    float scratch[2 * BATCH * 32];
+    const float* batch_ys = cog_network_run_batch(net, xs[0], BATCH, scratch);
+    bool same             = memcmp(batch_ys, expected[0].outputs, sizeof expected[0].outputs) == 0;
+    // a batch bigger than the context must not write past its buffers
+    const bool guarded = cog_network_forward(net, jobs[0].ctx, xs[0], BATCH + 1) == NULL;
+    for (size_t t = 0; t < THREADS; t++)
+    {
+        same &= memcmp(jobs[t].outputs, expected[t].outputs, sizeof jobs[t].outputs) == 0;
+        same &= same_grads(jobs[t].ctx, expected[t].ctx);
+        cog_network_context_destroy(jobs[t].ctx);
+        cog_network_context_destroy(expected[t].ctx);
+    }
+    cog_network_destroy(net);
+
+    if (!same)
+    {
+        printf("\033[31m[-] %s test failed: the threads results differ from the sequential "
+               "run\033[0m\n",
+               __FILE__);
+    }
+    else if (!guarded)
+    {
+        printf("\033[31m[-] %s test failed: a batch bigger than the context was run\033[0m\n",
+               __FILE__);
+    }
+    else
+    {
+        printf("\033[32m[+] %s passed\033[0m\n", __FILE__);
+    }
+    return 0;
+}
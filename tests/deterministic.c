@@ -0,0 +1,138 @@
+#define COGNI_THREADS
+#define COGNI_IMPLEMENTATION
+#include "cogni.h"
+
+#define LAYERS_LEN 3
+#define IN 64
+#define ROWS 203 // not a whole number of chunks
+#define LARGE_ROWS 8011 // many chunks in every shard
+#define STEPS 5
+#define MAX_THREADS 8
+
+/* the target is a smooth function of the first inputs */
+static void make_data(float* data, size_t rows)
+{
+    srand(1);
+    cog_array_rand_f(data, rows * (IN + 1), -1, 1);
+    for (size_t row = 0; row < rows; row++)
+    {
+        float* x = &data[row * (IN + 1)];
+        x[IN]    = x[0] * x[1] + sinf(x[2]);
+    }
+}
+
+/* returns the loss of every step and the final weights, every run starts from init */
+static error train(const Network* init, const float* data, size_t rows, size_t steps,
+                   size_t threads_len, float* losses, float* params)
+{
+    Network* net = cog_network_clone(init);
+    if (net == NULL)
+    {
+        return 1;
+    }
+
+    error err = 0;
+    for (size_t step = 0; step < steps && err == 0; step++)
+    {
+        err = cog_network_train_step_parallel(net, data, &data[IN], IN + 1, rows, 0.05,
+                                              threads_len, &losses[step]);
+    }
+    cog_network_get_params(net, params);
+    cog_network_destroy(net);
+    return err;
+}
+
+/* the gradient buffers of a step must not grow with the rows */
+static const char* test_large(const Network* init, size_t len)
+{
+    static float data[LARGE_ROWS * (IN + 1)];
+    make_data(data, LARGE_ROWS);
+    float* expected = malloc(sizeof(float) * len);
+    float* params   = malloc(sizeof(float) * len);
+    float expected_loss, loss;
+
+    cog_memory_reset_peak();
+    error err                  = train(init, data, LARGE_ROWS / 4, 1, MAX_THREADS, &loss, params);
+    const size_t quarter_bytes = cog_memory_peak(COG_MEM_GRADIENTS);
+    cog_memory_reset_peak();
+    err |= train(init, data, LARGE_ROWS, 1, 1, &expected_loss, expected);
+    err |= train(init, data, LARGE_ROWS, 1, MAX_THREADS, &loss, params);
+    const size_t bytes = cog_memory_peak(COG_MEM_GRADIENTS);
+    const bool same    = loss == expected_loss &&
+                         memcmp(params, expected, sizeof(float) * len) == 0;
+    free(expected);
+    free(params);
+
+    if (err != 0)
+    {
+        return "could not train on the large data";
+    }
+    if (!same)
+    {
+        return "the large data is not the same bits for 1 and 8 threads";
+    }
+    return bytes == quarter_bytes ? NULL : "the gradient memory grows with the rows";
+}
+
+int main(void)
+{
+    static float data[ROWS * (IN + 1)];
+    make_data(data, ROWS);
+
+    cog_set_deterministic(true);
+    const size_t sizes[LAYERS_LEN + 1]            = {IN, 128, 16, 1};
+    const Activision_type activisions[LAYERS_LEN] = {L_RELU, SIGMOID, NONE};
+    srand(0);
+    Network* init = cog_network_init(sizes, activisions, LAYERS_LEN);
+    if (init == NULL)
+    {
+        return 1;
+    }
+    const size_t len = cog_network_params_len(init);
+
+    float expected_losses[STEPS], losses[STEPS];
+    float* expected = malloc(sizeof(float) * len);
+    float* params   = malloc(sizeof(float) * len);
+    error err       = train(init, data, ROWS, STEPS, 1, expected_losses, expected);
+
+    size_t differ_at = 0;
+    for (size_t threads_len = 2; threads_len <= MAX_THREADS && err == 0; threads_len++)
+    {
+        err = train(init, data, ROWS, STEPS, threads_len, losses, params);
+        if (differ_at == 0 && (memcmp(losses, expected_losses, sizeof losses) != 0 ||
+                               memcmp(params, expected, sizeof(float) * len) != 0))
+        {
+            differ_at = threads_len;
+        }
+    }
+    const char* large = (err == 0 && differ_at == 0) ? test_large(init, len) : NULL;
+    cog_set_deterministic(false);
+    cog_network_destroy(init);
+    free(expected);
+    free(params);
+
+    if (err != 0)
+    {
+        printf("\033[31m[-] %s test failed: could not train\033[0m\n", __FILE__);
+    }
+    else if (large != NULL)
+    {
+        printf("\033[31m[-] %s test failed: %s\033[0m\n", __FILE__, large);
+    }
+    else if (differ_at != 0)
+    {
+        printf("\033[31m[-] %s test failed: %zu threads are not the same bits as 1\033[0m\n",
+               __FILE__, differ_at);
+    }
+    else if (!(expected_losses[STEPS - 1] < expected_losses[0]))
+    {
+        printf("\033[31m[-] %s test failed: the loss did not drop: %f -> %f\033[0m\n", __FILE__,
+               expected_losses[0], expected_losses[STEPS - 1]);
+    }
+    else
+    {
+        printf("\033[32m[+] %s \tpassed 1..%d threads avg mse %f -> %f\033[0m\n", __FILE__,
+               MAX_THREADS, expected_losses[0], expected_losses[STEPS - 1]);
+    }
+    return 0;
+}
@@ -0,0 +1,212 @@
+#define COGNI_IMPLEMENTATION
+#include "cogni.h"
+
+#define DATABASE_IMPLEMENTATION
+#include "database.h"
+
+// a missing worker fails the init quickly
+#define COG_RING_TIMEOUT_MS 1000
+#define DISTRIBUTED_IMPLEMENTATION
+#include "distributed.h"
+
+#include <sys/wait.h>
+
+#define LAYERS_LEN 4
+#define WORLD 3
+#define EPOCHS 2000
+#define LR 0.01
+
+const char* g_filename = "data/busses.csv";
+const char* g_address  = "unix:build/ring";
+const char* g_alone    = "unix:build/ring_alone";
+
+/* trains a clone of init on its shard and writes the weights after the first and the last step
+   to fd */
+static int worker(const Network* init, const char* address, size_t rank, int fd)
+{
+    size_t columns, rows;
+    float* xs;
+    ColumnStats stats;
+    stats_init(&stats, 4, NORM_STANDARD);
+    if (read_csv_normalized_f(g_filename, &xs, &columns, &rows, true, &stats, true) != 0)
+    {
+        return 1;
+    }
+    stats_destroy(&stats);
+    // rank 0 keeps the even rows, the others split the odd rows
+    shard_rows(xs, columns, &rows, rank == 0 ? 0 : 1, 2);
+    if (rank != 0)
+    {
+        shard_rows(xs, columns, &rows, rank - 1, WORLD - 1);
+    }
+
+    Network* net = cog_network_clone(init);
+    Ring* ring   = cog_ring_init(address, rank, WORLD);
+    if (net == NULL || ring == NULL)
+    {
+        return 1;
+    }
+
+    const size_t len = cog_network_params_len(net);
+    float* params    = malloc(sizeof(float) * 2 * len);
+    error err        = 0;
+    for (size_t epoch = 0; epoch < EPOCHS && err == 0; epoch++)
+    {
+        err = cog_ring_train_epoch(ring, net, xs, &xs[columns - 1], columns, rows, LR, NULL);
+        if (epoch == 0)
+        {
+            cog_network_get_params(net, params);
+        }
+    }
+    cog_network_get_params(net, &params[len]);
+    err |= (write(fd, params, sizeof(float) * 2 * len) != (ssize_t)(sizeof(float) * 2 * len));
+
+    free(params);
+    cog_ring_destroy(ring);
+    cog_network_destroy(net);
+    free_csv(xs);
+    return err;
+}
+
+/* forks the workers of a ring on address and checks the weights they send back, every worker
+   starts from the weights of init */
+static const char* test_ring(const Network* init, const char* address, float* start_mse,
+                             float* end_mse)
+{
+    int fds[WORLD][2];
+    pid_t pids[WORLD];
+    for (size_t rank = 0; rank < WORLD; rank++)
+    {
+        if (pipe(fds[rank]) != 0)
+        {
+            return "could not pipe";
+        }
+        pids[rank] = fork();
+        if (pids[rank] == 0)
+        {
+            close(fds[rank][0]);
+            _exit(worker(init, address, rank, fds[rank][1]));
+        }
+        close(fds[rank][1]);
+    }
+
+    Network* net      = cog_network_clone(init);
+    const size_t len  = cog_network_params_len(init);
+    float* params     = malloc(sizeof(float) * 2 * len * WORLD);
+    bool workers_fail = false;
+    for (size_t rank = 0; rank < WORLD; rank++)
+    {
+        int status = 0;
+        workers_fail |= (read(fds[rank][0], &params[rank * 2 * len], sizeof(float) * 2 * len) !=
+                         (ssize_t)(sizeof(float) * 2 * len));
+        close(fds[rank][0]);
+        waitpid(pids[rank], &status, 0);
+        workers_fail |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    }
+
+    // every worker applied the same averaged gradients
+    bool same = !workers_fail;
+    for (size_t rank = 1; rank < WORLD && same; rank++)
+    {
+        same = memcmp(params, &params[rank * 2 * len], sizeof(float) * 2 * len) == 0;
+    }
+
+
+    size_t columns, rows;
+    float* xs;
+    ColumnStats stats;
+    stats_init(&stats, 4, NORM_STANDARD);
+    if (read_csv_normalized_f(g_filename, &xs, &columns, &rows, true, &stats, true) != 0)
+    {
+        return "could not read the csv";
+    }
+    stats_destroy(&stats);
+    *start_mse = cog_network_mse(net, xs, &xs[columns - 1], columns, rows);
+
+    // the first step of the uneven shards is one full batch step over all the rows
+    Ring* alone = cog_ring_init(g_alone, 0, 1);
+    float* step = malloc(sizeof(float) * len);
+    bool weighted =
+        alone != NULL &&
+        cog_ring_train_epoch(alone, net, xs, &xs[columns - 1], columns, rows, LR, NULL) == 0;
+    cog_network_get_params(net, step);
+    for (size_t i = 0; i < len && weighted; i++)
+    {
+        weighted = fabsf(params[i] - step[i]) <= 1e-4f * (fabsf(step[i]) + 1);
+    }
+    // a ring without rows has no step to take
+    const bool empty =
+        alone != NULL &&
+        cog_ring_train_epoch(alone, net, xs, &xs[columns - 1], columns, 0, LR, NULL) != 0;
+    cog_ring_destroy(alone);
+    free(step);
+
+    cog_network_set_params(net, &params[len]);
+    *end_mse = cog_network_mse(net, xs, &xs[columns - 1], columns, rows);
+
+    cog_network_destroy(net);
+    free(params);
+    free_csv(xs);
+
+    if (workers_fail)
+    {
+        return "a worker failed";
+    }
+    if (!same)
+    {
+        return "the workers weights are not the same";
+    }
+    if (!weighted)
+    {
+        return "the uneven shards are not weighted by rows";
+    }
+    if (!empty)
+    {
+        return "a ring without rows trained";
+    }
+    return *end_mse < *start_mse / 2 ? NULL : "the avg mse did not drop";
+}
+
+int main(void)
+{
+    // the tcp ranks listen on port + rank, away from the ports of other runs
+    char tcp[64];
+    snprintf(tcp, sizeof tcp, "tcp:127.0.0.1:%d", 20000 + (int)(getpid() % 20000) * WORLD);
+    const char* addresses[] = {g_address, tcp};
+
+    const size_t sizes[LAYERS_LEN + 1]            = {4, 8, 7, 5, 1};
+    const Activision_type activisions[LAYERS_LEN] = {L_RELU, L_RELU, L_RELU, NONE};
+    srand(0);
+    Network* init = cog_network_init(sizes, activisions, LAYERS_LEN);
+    if (init == NULL)
+    {
+        return 1;
+    }
+
+    float start_mse = 0, end_mse = 0;
+    const char* fail = NULL;
+    for (size_t i = 0; i < sizeof addresses / sizeof *addresses && fail == NULL; i++)
+    {
+        fail = test_ring(init, addresses[i], &start_mse, &end_mse);
+    }
+    cog_network_destroy(init);
+    // a bad rank and a missing neighbour fail instead of hanging
+    if (fail == NULL &&
+        (cog_ring_init(g_address, WORLD, WORLD) != NULL || cog_ring_init(g_address, 0, 0) != NULL ||
+         cog_ring_init(g_address, 0, WORLD) != NULL))
+    {
+        fail = "a bad ring was created";
+    }
+
+    if (fail != NULL)
+    {
+        printf("\033[31m[-] %s test failed: %s: %f -> %f\033[0m\n", __FILE__, fail, start_mse,
+               end_mse);
+    }
+    else
+    {
+        printf("\033[32m[+] %s \tpassed %d workers on unix and tcp avg mse %f -> %f\033[0m\n",
+               __FILE__, WORLD, start_mse, end_mse);
+    }
+    return 0;
+}
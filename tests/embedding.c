@@ -0,0 +1,110 @@
+#define COGNI_IMPLEMENTATION
+#include "cogni.h"
+
+#include <math.h>
+
+#define VOCAB 50
+#define DIM 6
+#define BATCH 8
+
+/* the embedding must match a fully connected layer on one-hot inputs */
+int main(void)
+{
+    srand(0);
+    LayerEmbedding* embedding = cog_embedding_init(VOCAB, DIM);
+    LayerFC* dense            = cog_layer_init(VOCAB, DIM);
+    if (embedding == NULL || dense == NULL)
+    {
+        return 1;
+    }
+    for (size_t d = 0; d < DIM; d++)
+    {
+        for (size_t id = 0; id < VOCAB; id++)
+        {
+            dense->neurons[d].w[id] = embedding->w[id * DIM + d];
+        }
+        *dense->neurons[d].b = 0;
+    }
+    const float* before = memcpy(malloc(sizeof(float) * VOCAB * DIM), embedding->w,
+                                 sizeof(float) * VOCAB * DIM);
+
+    // a repeated id must sum its gradients
+    const size_t ids[BATCH]      = {3, 17, 3, 42, 0, 17, 49, 3};
+    float one_hot[BATCH * VOCAB] = {0};
+    for (size_t i = 0; i < BATCH; i++)
+    {
+        one_hot[i * VOCAB + ids[i]] = 1;
+    }
+
+    float ys[BATCH * DIM], dense_ys[BATCH * DIM], deltas[BATCH * DIM], dense_deltas[BATCH * DIM];
+    const error run_error = cog_embedding_run(embedding, ids, ys, BATCH);
+    cog_layer_run_batch(dense, one_hot, dense_ys, BATCH);
+    cog_array_rand_f(deltas, BATCH * DIM, -1, 1);
+    memcpy(dense_deltas, deltas, sizeof deltas);
+
+    const float lr = 0.5;
+    cog_embedding_zero_grad(embedding);
+    const error backward_error = cog_embedding_backward(embedding, ids, deltas, BATCH);
+    cog_embedding_apply_derives(embedding, lr);
+    cog_layer_zero_grad(dense);
+    cog_layer_backward_batch(dense, NONE, one_hot, dense_ys, dense_deltas, NULL, BATCH);
+    cog_layer_apply_derives(dense, lr);
+
+    float max_diff      = 0;
+    size_t moved_unused = 0;
+    for (size_t i = 0; i < BATCH * DIM; i++)
+    {
+        max_diff = fmaxf(max_diff, fabsf(ys[i] - dense_ys[i]));
+    }
+    for (size_t id = 0; id < VOCAB; id++)
+    {
+        for (size_t d = 0; d < DIM; d++)
+        {
+            const float w = embedding->w[id * DIM + d];
+            max_diff      = fmaxf(max_diff, fabsf(w - dense->neurons[d].w[id]));
+            moved_unused += !embedding->is_touched[id] && w != before[id * DIM + d];
+        }
+    }
+    const size_t touched_len = embedding->touched_len;
+    cog_embedding_zero_grad(embedding);
+    float left_grad = 0;
+    for (size_t i = 0; i < VOCAB * DIM; i++)
+    {
+        left_grad = fmaxf(left_grad, fabsf(embedding->dw[i]));
+    }
+
+    // a bad id is rejected before any row gets a gradient
+    const size_t bad_ids[2] = {1, VOCAB};
+    const bool rejected     = cog_embedding_backward(embedding, bad_ids, deltas, 2) != 0 &&
+                              embedding->touched_len == 0;
+
+    cog_embedding_destroy(embedding);
+    cog_layer_destroy(dense);
+    free((float*)before);
+
+    if (run_error != 0 || backward_error != 0 || !(max_diff < 1e-5))
+    {
+        printf("\033[31m[-] %s test failed: the embedding differs from one-hot by %f\033[0m\n",
+               __FILE__, max_diff);
+    }
+    else if (touched_len != 5 || moved_unused != 0)
+    {
+        printf("\033[31m[-] %s test failed: %zu rows touched and %zu unused weights "
+               "moved\033[0m\n",
+               __FILE__, touched_len, moved_unused);
+    }
+    else if (left_grad != 0)
+    {
+        printf("\033[31m[-] %s test failed: zero_grad left %f\033[0m\n", __FILE__, left_grad);
+    }
+    else if (!rejected)
+    {
+        printf("\033[31m[-] %s test failed: an id out of the vocab got a gradient\033[0m\n",
+               __FILE__);
+    }
+    else
+    {
+        printf("\033[32m[+] %s passed\033[0m\n", __FILE__);
+    }
+    return 0;
+}
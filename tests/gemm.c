@@ -0,0 +1,192 @@
+#define COGNI_IMPLEMENTATION
+#include "cogni.h"
+
+#define MAX_DIM 70
+#define BATCH 9
+
+static float g_a[MAX_DIM * MAX_DIM];
+static float g_b[MAX_DIM * MAX_DIM];
+static float g_c[MAX_DIM * MAX_DIM];
+static float g_expected[MAX_DIM * MAX_DIM];
+
+static void naive_gemm(bool trans_a, bool trans_b, size_t m, size_t n, size_t k, float alpha,
+                       float beta)
+{
+    for (size_t i = 0; i < m; i++)
+    {
+        for (size_t j = 0; j < n; j++)
+        {
+            float sum = 0;
+            for (size_t p = 0; p < k; p++)
+            {
+                const float a = trans_a ? g_a[p * m + i] : g_a[i * k + p];
+                const float b = trans_b ? g_b[j * k + p] : g_b[p * n + j];
+                sum += a * b;
+            }
+            g_expected[i * n + j] = alpha * sum + beta * g_expected[i * n + j];
+        }
+    }
+}
+
+static bool close_enough(const float* x, const float* y, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        if (fabsf(x[i] - y[i]) > 1e-3f * (fabsf(y[i]) + 1))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static const char* test_gemm(void)
+{
+    const size_t dims[][3] = {{1, 1, 1}, {5, 7, 3}, {17, 9, 33}, {64, 64, 64}, {70, 13, 69}};
+    for (size_t d = 0; d < sizeof dims / sizeof *dims; d++)
+    {
+        const size_t m = dims[d][0], n = dims[d][1], k = dims[d][2];
+        for (int trans = 0; trans < 4; trans++)
+        {
+            const bool trans_a = trans & 1;
+            const bool trans_b = trans & 2;
+            cog_array_rand_f(g_a, m * k, -1, 1);
+            cog_array_rand_f(g_b, k * n, -1, 1);
+            cog_array_rand_f(g_c, m * n, -1, 1);
+            memcpy(g_expected, g_c, sizeof(float) * m * n);
+
+            naive_gemm(trans_a, trans_b, m, n, k, 0.5f, 2);
+            cog_gemm(trans_a, trans_b, m, n, k, 0.5f, g_a, trans_a ? m : k, g_b,
+                     trans_b ? k : n, 2, g_c, n);
+            if (!close_enough(g_c, g_expected, m * n))
+            {
+                return "gemm is not the same as the naive multiplication";
+            }
+        }
+    }
+    return NULL;
+}
+
+static void* failing_alloc(void* ctx, size_t size)
+{
+    (void)ctx;
+    (void)size;
+    return NULL;
+}
+
+static void failing_free(void* ctx, void* ptr, size_t size)
+{
+    (void)ctx;
+    (void)ptr;
+    (void)size;
+}
+
+/* without the panels the result must be the same bits, the deterministic mode relies on it */
+static const char* test_no_panels(void)
+{
+    const size_t m = 17, n = 9, k = 33;
+    cog_array_rand_f(g_a, m * k, -1, 1);
+    cog_array_rand_f(g_b, k * n, -1, 1);
+    cog_array_rand_f(g_c, m * n, -1, 1);
+    memcpy(g_expected, g_c, sizeof(float) * m * n);
+    cog_gemm(false, true, m, n, k, 0.5f, g_a, k, g_b, k, 2, g_expected, n);
+
+    const Allocator previous =
+        cog_set_allocator((Allocator){.alloc = failing_alloc, .free = failing_free});
+    cog_gemm(false, true, m, n, k, 0.5f, g_a, k, g_b, k, 2, g_c, n);
+    cog_set_allocator(previous);
+    return memcmp(g_c, g_expected, sizeof(float) * m * n) == 0
+               ? NULL
+               : "gemm without panels is not the same bits";
+}
+
+static const char* test_layer(void)
+{
+    LayerFC* layer = cog_layer_init(MAX_DIM, MAX_DIM);
+    float xs[BATCH * MAX_DIM];
+    float ys[BATCH * MAX_DIM];
+    float deltas[BATCH * MAX_DIM];
+    cog_array_rand_f(xs, BATCH * MAX_DIM, -1, 1);
+    cog_array_rand_f(deltas, BATCH * MAX_DIM, -1, 1);
+
+    cog_layer_run_batch(layer, xs, ys, BATCH);
+    for (size_t i = 0; i < BATCH; i++)
+    {
+        if (!close_enough(&ys[i * MAX_DIM], cog_layer_run(layer, &xs[i * MAX_DIM]), MAX_DIM))
+        {
+            cog_layer_destroy(layer);
+            return "batched forward is not the same as the layer run";
+        }
+    }
+
+    // the weights gradient outer products against the per sample backprop
+    cog_layer_zero_grad(layer);
+    for (size_t i = 0; i < BATCH; i++)
+    {
+        cog_layer_run(layer, &xs[i * MAX_DIM]);
+        cog_layer_backpropagate_batch(layer, &deltas[i * MAX_DIM], BATCH);
+    }
+    memcpy(g_expected, layer->neurons[0].dw, sizeof(float) * MAX_DIM * MAX_DIM);
+
+    cog_layer_zero_grad(layer);
+    cog_layer_backward_batch(layer, NONE, xs, ys, deltas, NULL, BATCH);
+    const bool same = close_enough(layer->neurons[0].dw, g_expected, MAX_DIM * MAX_DIM);
+    cog_layer_destroy(layer);
+    return same ? NULL : "batched weights gradient is not the same as the per sample backprop";
+}
+
+int main(void)
+{
+    const char* failed = test_gemm();
+
+    // small blocks so every edge of the tiling is used
+    const GemmConfig config = cog_gemm_get_config();
+    cog_gemm_set_config((GemmConfig){.mc = 8, .kc = 5, .nc = 16});
+    if (failed == NULL)
+    {
+        failed = test_gemm();
+    }
+    // zero blocks are rounded up to one register block
+    cog_gemm_set_config((GemmConfig){.mc = 0, .kc = 0, .nc = 0});
+    const GemmConfig zeros = cog_gemm_get_config();
+    if (failed == NULL && (zeros.mc != COGNI_GEMM_MR || zeros.nc != COGNI_GEMM_NR || zeros.kc != 1))
+    {
+        failed = "zero blocks were not rounded up";
+    }
+    if (failed == NULL)
+    {
+        failed = test_gemm();
+    }
+    cog_gemm_set_config(config);
+
+    // no memory for the panels
+    const Allocator previous =
+        cog_set_allocator((Allocator){.alloc = failing_alloc, .free = failing_free});
+    if (failed == NULL)
+    {
+        failed = test_gemm();
+    }
+    cog_set_allocator(previous);
+    // many k blocks, each one is added to c on its own
+    cog_gemm_set_config((GemmConfig){.mc = 8, .kc = 5, .nc = 16});
+    if (failed == NULL)
+    {
+        failed = test_no_panels();
+    }
+    cog_gemm_set_config(config);
+
+    if (failed == NULL)
+    {
+        failed = test_layer();
+    }
+
+    if (failed != NULL)
+    {
+        printf("\033[31m[-] %s test failed: %s\033[0m\n", __FILE__, failed);
+    }
+    else
+    {
+        printf("\033[32m[+] %s passed\033[0m\n", __FILE__);
+    }
+    return 0;
+}
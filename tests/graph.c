@@ -0,0 +1,97 @@
+#define COGNI_IMPLEMENTATION
+#include "cogni.h"
+
+#include <math.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define IN 4
+#define SAMPLES 32
+
+const char* g_path = "build/graph.net";
+
+/* the optimized network on raw inputs must match the original on normalized inputs */
+int main(void)
+{
+    srand(0);
+    const size_t sizes[]                = {IN, 8, 6, 5, 3, 1};
+    const Activision_type activisions[] = {L_RELU, NONE, NONE, L_RELU, NONE};
+    Network* net                        = cog_network_init(sizes, activisions, 5);
+    // a bottleneck gets bigger when merged and must stay
+    const size_t bottleneck_sizes[]                = {16, 2, 16};
+    const Activision_type bottleneck_activisions[] = {NONE, NONE};
+    Network* bottleneck = cog_network_init(bottleneck_sizes, bottleneck_activisions, 2);
+    if (net == NULL || bottleneck == NULL)
+    {
+        return 1;
+    }
+
+    float scale[IN], shift[IN], raw[SAMPLES * IN], normalized[SAMPLES * IN];
+    cog_array_rand_f(scale, IN, 0.1, 2);
+    cog_array_rand_f(shift, IN, -5, 5);
+    cog_array_rand_f(raw, SAMPLES * IN, -10, 10);
+    for (size_t i = 0; i < SAMPLES * IN; i++)
+    {
+        normalized[i] = (raw[i] - shift[i % IN]) * scale[i % IN];
+    }
+
+    Network* optimized      = cog_network_optimize(net, scale, shift);
+    Network* kept           = cog_network_optimize(bottleneck, NULL, NULL);
+    const error write_error = cog_network_write(g_path, optimized);
+    Network* loaded         = cog_network_read(g_path);
+
+    // a truncated file must fail
+    struct stat st;
+    Network* truncated = optimized;
+    if (stat(g_path, &st) == 0 && truncate(g_path, st.st_size / 2) == 0)
+    {
+        truncated = cog_network_read(g_path);
+    }
+    // so must a write to a full disk, where there is a device that is always full
+    const bool full_failed = access("/dev/full", W_OK) != 0 ||
+                             cog_network_write("/dev/full", optimized) != 0;
+    if (optimized == NULL || kept == NULL || write_error != 0 || loaded == NULL ||
+        truncated != NULL || !full_failed)
+    {
+        return 1;
+    }
+
+    float max_diff     = 0;
+    bool loaded_differ = false;
+    for (size_t i = 0; i < SAMPLES; i++)
+    {
+        const float expected = cog_network_run(net, &normalized[i * IN])[0];
+        const float got      = cog_network_run(optimized, &raw[i * IN])[0];
+        max_diff             = fmaxf(max_diff, fabsf(expected - got) / fmaxf(1, fabsf(expected)));
+        loaded_differ |= got != cog_network_run(loaded, &raw[i * IN])[0];
+    }
+
+    const size_t optimized_len = optimized->len;
+    const size_t kept_len      = kept->len;
+    cog_network_destroy(net);
+    cog_network_destroy(bottleneck);
+    cog_network_destroy(optimized);
+    cog_network_destroy(kept);
+    cog_network_destroy(loaded);
+
+    if (optimized_len != 3 || kept_len != 2)
+    {
+        printf("\033[31m[-] %s test failed: optimized to %zu layers (expected 3) and the "
+               "bottleneck to %zu (expected 2)\033[0m\n",
+               __FILE__, optimized_len, kept_len);
+    }
+    else if (!(max_diff < 1e-4))
+    {
+        printf("\033[31m[-] %s test failed: the optimized network differs by %f\033[0m\n",
+               __FILE__, max_diff);
+    }
+    else if (loaded_differ)
+    {
+        printf("\033[31m[-] %s test failed: the loaded network differs\033[0m\n", __FILE__);
+    }
+    else
+    {
+        printf("\033[32m[+] %s passed\033[0m\n", __FILE__);
+    }
+    return 0;
+}
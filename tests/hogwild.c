@@ -0,0 +1,91 @@
+#define COGNI_THREADS
+#define COGNI_IMPLEMENTATION
+#include "cogni.h"
+
+#define DATABASE_IMPLEMENTATION
+#include "database.h"
+
+#include <unistd.h>
+
+#define LAYERS_LEN 4
+#define THREADS 4
+#define EPOCHS 300
+// hogwild loses some updates, it has to keep at least half of the drop of the sync run
+#define MIN_RATIO 0.5
+
+const char* g_filename = "data/busses.csv";
+
+int main(void)
+{
+    size_t columns, rows;
+    float* xs;
+    const size_t stride = 5;
+
+    ColumnStats stats;
+    stats_init(&stats, 4, NORM_STANDARD);
+    if (read_csv_normalized_f(g_filename, &xs, &columns, &rows, true, &stats, true) != 0)
+    {
+        return 1;
+    }
+    stats_destroy(&stats);
+
+    const float lr = 0.0002;
+
+    const size_t sizes[LAYERS_LEN + 1]            = {4, 8, 7, 5, 1};
+    const Activision_type activisions[LAYERS_LEN] = {L_RELU, L_RELU, L_RELU, NONE};
+    srand(0);
+    Network* init = cog_network_init(sizes, activisions, LAYERS_LEN);
+    if (init == NULL)
+    {
+        return 1;
+    }
+    // both runs start from the same weights
+    Network* sync  = cog_network_clone(init);
+    Network* async = cog_network_clone(init);
+    if (sync == NULL || async == NULL)
+    {
+        return 1;
+    }
+    const float init_mse = cog_network_mse(init, xs, &xs[stride - 1], stride, rows);
+
+    // the synchronous baseline is the same sgd on one thread
+    double start = cog_seconds();
+    cog_network_train_hogwild(sync, xs, &xs[stride - 1], stride, rows, EPOCHS, lr, 1, NULL);
+    const double sync_time = cog_seconds() - start;
+    const float sync_mse   = cog_network_mse(sync, xs, &xs[stride - 1], stride, rows);
+
+    start = cog_seconds();
+    cog_network_train_hogwild(async, xs, &xs[stride - 1], stride, rows, EPOCHS, lr, THREADS, NULL);
+    const double async_time = cog_seconds() - start;
+    const float async_mse   = cog_network_mse(async, xs, &xs[stride - 1], stride, rows);
+
+    cog_network_destroy(init);
+    cog_network_destroy(sync);
+    cog_network_destroy(async);
+    free_csv(xs);
+
+    // the thread scheduling changes the hogwild result, so it is held to the drop of the sync
+    // run from the same weights and not to its final mse
+    const float ratio = (init_mse - async_mse) / (init_mse - sync_mse);
+    // the threads share the rows of an epoch, they can only be faster with a core each
+    const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (!(sync_mse < init_mse) || !(ratio >= MIN_RATIO))
+    {
+        printf("\033[31m[-] %s test failed: hogwild dropped the avg mse %.2f of the sync run, "
+               "less then %.2f: %f -> sync %f (%fs) hogwild %f (%fs)\033[0m\n",
+               __FILE__, ratio, MIN_RATIO, init_mse, sync_mse, sync_time, async_mse, async_time);
+    }
+    else if (cores >= 2 && !(async_time < sync_time))
+    {
+        printf("\033[31m[-] %s test failed: hogwild x%d took %fs on %ld cores, sync took %fs"
+               "\033[0m\n",
+               __FILE__, THREADS, async_time, cores, sync_time);
+    }
+    else
+    {
+        printf("\033[32m[+] %s \t\tpassed sync %f (%.3fs) hogwild x%d %f (%.3fs) ratio %.2f"
+               "\033[0m\n",
+               __FILE__, sync_mse, sync_time, THREADS, async_mse, async_time, ratio);
+    }
+    return 0;
+}
@@ -0,0 +1,118 @@
+#define COGNI_IMPLEMENTATION
+#include "cogni.h"
+
+#define IN_FEATURES 24
+#define OUT_FEATURES 16
+#define RANK 4
+
+/* loss = c . ys, the max difference of the first layer gradients to the finite differences */
+static float grad_error(LayerLowRank* fact, const float* xs)
+{
+    float c[OUT_FEATURES];
+    cog_array_rand_f(c, OUT_FEATURES, -1, 1);
+
+    cog_layer_lowrank_zero_grad(fact);
+    cog_layer_lowrank_run(fact, xs);
+    cog_layer_lowrank_backpropagate_batch(fact, c, 1);
+
+    const float h = 1e-2f;
+    float max_err = 0;
+    for (size_t i = 0; i < RANK * IN_FEATURES; i++)
+    {
+        float* w       = &fact->first->neurons[0].w[i];
+        const float w0 = *w;
+        float loss[2]  = {0, 0};
+        for (size_t side = 0; side < 2; side++)
+        {
+            *w              = w0 + (side ? -h : h);
+            const float* ys = cog_layer_lowrank_run(fact, xs);
+            for (size_t o = 0; o < OUT_FEATURES; o++)
+            {
+                loss[side] += c[o] * ys[o];
+            }
+        }
+        *w                 = w0;
+        const float finite = (loss[0] - loss[1]) / (2 * h);
+        max_err = fmaxf(max_err, fabsf(finite - fact->first->neurons[0].dw[i]));
+    }
+    return max_err;
+}
+
+int main(void)
+{
+    srand(1);
+    LayerFC* layer = cog_layer_init(IN_FEATURES, OUT_FEATURES);
+    float xs[IN_FEATURES];
+    cog_array_rand_f(xs, IN_FEATURES, -1, 1);
+
+    // make the weights exactly rank RANK: w = a * b
+    float a[OUT_FEATURES * RANK];
+    float b[RANK * IN_FEATURES];
+    cog_array_rand_f(a, OUT_FEATURES * RANK, -1, 1);
+    cog_array_rand_f(b, RANK * IN_FEATURES, -1, 1);
+    for (size_t o = 0; o < OUT_FEATURES; o++)
+    {
+        for (size_t i = 0; i < IN_FEATURES; i++)
+        {
+            float sum = 0;
+            for (size_t k = 0; k < RANK; k++)
+            {
+                sum += a[o * RANK + k] * b[k * IN_FEATURES + i];
+            }
+            layer->neurons[o].w[i] = sum;
+        }
+    }
+
+    float errors[OUT_FEATURES];
+    cog_layer_rank_errors(layer, errors, OUT_FEATURES);
+
+    const float* expected = cog_layer_run(layer, xs);
+
+    const char* failed = NULL;
+    for (size_t r = 1; r < OUT_FEATURES; r++)
+    {
+        if (errors[r] > errors[r - 1] + 1e-6f)
+        {
+            failed = "rank errors are not decreasing";
+        }
+    }
+    if (errors[RANK - 1] > 1e-4f || errors[RANK - 2] < 1e-3f)
+    {
+        failed = "rank errors do not show the real rank";
+    }
+
+    for (Factor_type type = 0; type < COG_FACTOR_LEN; type++)
+    {
+        float err          = 1;
+        LayerLowRank* fact = cog_layer_factorize(layer, RANK, type, &err);
+        const float* ys    = cog_layer_lowrank_run(fact, xs);
+        for (size_t o = 0; o < OUT_FEATURES; o++)
+        {
+            if (fabsf(ys[o] - expected[o]) > 1e-3f)
+            {
+                failed = "factorized output is not the same as the layer";
+            }
+        }
+        if (err > 1e-4f)
+        {
+            failed = "factorization error is too big";
+        }
+        if (grad_error(fact, xs) > 1e-2f)
+        {
+            failed = "fine tuning gradients differ from the finite differences";
+        }
+        cog_layer_lowrank_destroy(fact);
+    }
+
+    cog_layer_destroy(layer);
+
+    if (failed != NULL)
+    {
+        printf("\033[31m[-] %s test failed: %s\033[0m\n", __FILE__, failed);
+    }
+    else
+    {
+        printf("\033[32m[+] %s passed\033[0m\n", __FILE__);
+    }
+    return 0;
+}
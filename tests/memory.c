@@ -0,0 +1,185 @@
+#define COGNI_IMPLEMENTATION
+#include "cogni.h"
+
+// the dataset is counted by the cogni allocator
+#define DATABASE_COGNI_ALLOCATOR
+#define DATABASE_IMPLEMENTATION
+#include "database.h"
+
+#include <stdint.h>
+
+#define LAYERS_LEN 2
+#define ARENA_SIZE (64 * 1024)
+
+const char* g_filename = "data/busses.csv";
+
+typedef struct
+{
+    size_t allocs;
+    size_t frees;
+} Counts;
+
+static void* counting_alloc(void* ctx, size_t size)
+{
+    ((Counts*)ctx)->allocs++;
+    return malloc(size);
+}
+
+static void counting_free(void* ctx, void* ptr, size_t size)
+{
+    (void)size;
+    ((Counts*)ctx)->frees++;
+    free(ptr);
+}
+
+static bool nothing_allocated(void)
+{
+    for (Memory_type type = 0; type < COG_MEM_LEN; type++)
+    {
+        if (cog_memory_current(type) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static const char* test_counters(void)
+{
+    const size_t sizes[LAYERS_LEN + 1]            = {4, 16, 1};
+    const Activision_type activisions[LAYERS_LEN] = {RELU, NONE};
+    const size_t params_bytes                     = sizeof(float) * ((4 + 1) * 16 + (16 + 1) * 1);
+
+    Network* net = cog_network_init(sizes, activisions, LAYERS_LEN);
+    if (net == NULL)
+    {
+        return "could not init the network";
+    }
+    const bool counted = cog_memory_current(COG_MEM_PARAMETERS) == params_bytes &&
+                         cog_memory_current(COG_MEM_GRADIENTS) == params_bytes &&
+                         cog_memory_current(COG_MEM_ACTIVATIONS) > 0;
+    bool aligned = true;
+    for (size_t l = 0; l < net->len; l++)
+    {
+        aligned &= (uintptr_t)net->layers[l]->neurons[0].w % COGNI_CACHE_LINE == 0;
+        aligned &= (uintptr_t)net->layers[l]->neurons[0].dw % COGNI_CACHE_LINE == 0;
+    }
+    float* page = cog_malloc_aligned(100, 4096, COG_MEM_OTHER);
+    aligned &= page != NULL && (uintptr_t)page % 4096 == 0;
+    cog_free(page);
+    // the header and the alignment padding must not wrap the size around
+    const bool overflow = cog_malloc_aligned(SIZE_MAX - 8, 64, COG_MEM_OTHER) == NULL;
+    cog_network_destroy(net);
+
+    if (!counted)
+    {
+        return "the network memory is not counted by category";
+    }
+    if (!aligned)
+    {
+        return "the parameters are not aligned";
+    }
+    if (!overflow)
+    {
+        return "an allocation that overflows the size was made";
+    }
+    if (cog_memory_peak(COG_MEM_PARAMETERS) < params_bytes || !nothing_allocated())
+    {
+        return "the counters did not return to zero after destroy";
+    }
+    cog_memory_reset_peak();
+    if (cog_memory_peak(COG_MEM_PARAMETERS) != 0)
+    {
+        return "the peak was not reset";
+    }
+
+    size_t columns, rows;
+    float* xs;
+    if (read_csv_f(g_filename, &xs, &columns, &rows, true) != 0)
+    {
+        return "could not read the csv";
+    }
+    const bool counted_xs = cog_memory_current(COG_MEM_DATASET) == sizeof(float) * columns * rows;
+    free_csv(xs);
+    return counted_xs && nothing_allocated() ? NULL : "the dataset is not counted";
+}
+
+static const char* test_arena(void)
+{
+    static char buffer[ARENA_SIZE];
+    const size_t sizes[LAYERS_LEN + 1]            = {4, 16, 1};
+    const size_t big_sizes[LAYERS_LEN + 1]        = {4, 4096, 1};
+    const Activision_type activisions[LAYERS_LEN] = {RELU, NONE};
+
+    Arena arena;
+    cog_arena_init(&arena, buffer, sizeof buffer);
+    const Allocator previous = cog_set_allocator(cog_arena_allocator(&arena));
+    srand(0);
+    Network* net = cog_network_init(sizes, activisions, LAYERS_LEN);
+    // over the budget
+    Network* big = cog_network_init(big_sizes, activisions, LAYERS_LEN);
+    cog_set_allocator(previous);
+
+    srand(0);
+    Network* expected = cog_network_init(sizes, activisions, LAYERS_LEN);
+    if (net == NULL || big != NULL || expected == NULL)
+    {
+        return "the arena did not keep the budget";
+    }
+
+    const char* w     = (const char*)net->layers[0]->neurons[0].w;
+    const float xs[4] = {0.5, -1, 2, 0.25};
+    bool same         = w >= buffer && w < buffer + sizeof buffer;
+    same &= cog_network_run(net, xs)[0] == cog_network_run(expected, xs)[0];
+    // freed through the arena after the allocator was restored
+    cog_network_destroy(net);
+    cog_network_destroy(expected);
+    if (!same || !nothing_allocated())
+    {
+        return "the arena network is not the same";
+    }
+
+    cog_arena_reset(&arena);
+    cog_set_allocator(cog_arena_allocator(&arena));
+    float* first  = cog_malloc(100, COG_MEM_OTHER);
+    float* second = cog_malloc(100, COG_MEM_OTHER);
+    cog_set_allocator(previous);
+    cog_free(second);
+    cog_free(first);
+    return arena.used == 0 && arena.peak > 0 ? NULL : "the arena did not give back the blocks";
+}
+
+static const char* test_allocator_ctx(void)
+{
+    Counts counts            = {0};
+    const Allocator previous = cog_set_allocator(
+        (Allocator){.alloc = counting_alloc, .free = counting_free, .ctx = &counts});
+    LayerEmbedding* embedding = cog_embedding_init(10, 4);
+    cog_set_allocator(previous);
+    cog_embedding_destroy(embedding);
+
+    if (embedding == NULL || counts.allocs == 0 || counts.allocs != counts.frees)
+    {
+        return "the user allocator was not used for every block";
+    }
+    return NULL;
+}
+
+int main(void)
+{
+    const char* (*tests[])(void) = {test_counters, test_arena, test_allocator_ctx};
+    const char* fail             = NULL;
+    for (size_t i = 0; i < sizeof tests / sizeof *tests && fail == NULL; i++)
+    {
+        fail = tests[i]();
+    }
+    if (fail != NULL)
+    {
+        printf("\033[31m[-] %s test failed: %s\033[0m\n", __FILE__, fail);
+    }
+    else
+    {
+        printf("\033[32m[+] %s passed\033[0m\n", __FILE__);
+    }
+    return 0;
+}
@@ -0,0 +1,124 @@
+#define COGNI_IMPLEMENTATION
+#include "cogni.h"
+
+#define DATABASE_IMPLEMENTATION
+#include "database.h"
+
+#define MODELS 8
+#define LAYERS_LEN 4
+
+const char* g_filename = "data/busses.csv";
+
+/* the reference: one network trained alone with the same math */
+static void train_network(Network* net, const float* xs, size_t rows, size_t stride, float lr,
+                          size_t epochs)
+{
+    float deltas[8];
+    float grad_in[8];
+    for (size_t epoch = 0; epoch < epochs; epoch++)
+    {
+        for (size_t l = 0; l < net->len; l++)
+        {
+            cog_layer_zero_grad(net->layers[l]);
+        }
+        for (size_t pos = 0; pos < rows; pos++)
+        {
+            const float* sample = &xs[pos * stride];
+            const float pred    = cog_network_run(net, sample)[0];
+            deltas[0]           = cog_mse_deriv(sample[stride - 1], pred) / rows;
+            for (size_t l = net->len; l-- > 0;)
+            {
+                LayerFC* layer = net->layers[l];
+                cog_layer_backward_batch(layer, net->activisions[l], layer->inputs,
+                                         layer->outputs, deltas, (l > 0) ? grad_in : NULL, 1);
+                memcpy(deltas, grad_in, sizeof deltas);
+            }
+        }
+        for (size_t l = 0; l < net->len; l++)
+        {
+            cog_layer_apply_derives(net->layers[l], lr);
+        }
+    }
+}
+
+int main(void)
+{
+    size_t columns, rows;
+    float* xs;
+    const size_t stride = 5;
+    if (read_csv_f(g_filename, &xs, &columns, &rows, true) != 0)
+    {
+        return 1;
+    }
+
+    const size_t sizes[LAYERS_LEN + 1]            = {4, 8, 7, 5, 1};
+    const Activision_type activisions[LAYERS_LEN] = {L_RELU, L_RELU, L_RELU, NONE};
+    unsigned seeds[MODELS];
+    for (size_t k = 0; k < MODELS; k++)
+    {
+        seeds[k] = 1234 + k;
+    }
+
+    ModelBatch* batch = cog_model_batch_init(sizes, activisions, LAYERS_LEN, MODELS, seeds);
+    Network* nets[MODELS];
+    for (size_t k = 0; k < MODELS; k++)
+    {
+        batch->lr[k] = 0.000001f * (k + 1);
+        nets[k]      = cog_network_init(sizes, activisions, LAYERS_LEN);
+        cog_model_batch_export(batch, k, nets[k]);
+    }
+
+    // all the models train in lockstep
+    const size_t epochs = 20;
+    float d_mse[MODELS];
+    for (size_t epoch = 0; epoch < epochs; epoch++)
+    {
+        cog_model_batch_zero_grad(batch);
+        for (size_t pos = 0; pos < rows; pos++)
+        {
+            const float* sample = &xs[pos * stride];
+            const float* preds  = cog_model_batch_run(batch, sample);
+            for (size_t k = 0; k < MODELS; k++)
+            {
+                d_mse[k] = cog_mse_deriv(sample[stride - 1], preds[k]);
+            }
+            cog_model_batch_backpropagate_batch(batch, d_mse, rows);
+        }
+        cog_model_batch_apply_derives(batch);
+    }
+
+    const char* failed = NULL;
+    for (size_t k = 0; k < MODELS; k++)
+    {
+        train_network(nets[k], xs, rows, stride, batch->lr[k], epochs);
+    }
+    for (size_t pos = 0; pos < rows && failed == NULL; pos++)
+    {
+        const float* preds = cog_model_batch_run(batch, &xs[pos * stride]);
+        for (size_t k = 0; k < MODELS; k++)
+        {
+            const float expected = cog_network_run(nets[k], &xs[pos * stride])[0];
+            if (!(fabsf(preds[k] - expected) <= 1e-3f * (fabsf(expected) + 1)))
+            {
+                failed = "a model in the batch is not the same as training it alone";
+            }
+        }
+    }
+
+    for (size_t k = 0; k < MODELS; k++)
+    {
+        cog_network_destroy(nets[k]);
+    }
+    cog_model_batch_destroy(batch);
+    free_csv(xs);
+
+    if (failed != NULL)
+    {
+        printf("\033[31m[-] %s test failed: %s\033[0m\n", __FILE__, failed);
+    }
+    else
+    {
+        printf("\033[32m[+] %s passed\033[0m\n", __FILE__);
+    }
+    return 0;
+}
@@ -0,0 +1,141 @@
+#define COGNI_IMPLEMENTATION
+#include "cogni.h"
+
+#define DATABASE_IMPLEMENTATION
+#include "database.h"
+
+const char* g_filename = "data/busses.csv";
+const char* g_stats    = "build/busses.stats";
+
+#define LAYERS_LEN 4
+#define FEATURES 4
+
+static float run(LayerFC** layers, LayerActivision fun, const float* xs)
+{
+    const float* out = xs;
+    for (size_t l = 0; l < LAYERS_LEN; l++)
+    {
+        out = cog_layer_run(layers[l], out);
+        if (l + 1 < LAYERS_LEN)
+        {
+            out = cog_layer_activate(fun, layers[l]);
+        }
+    }
+    return out[0];
+}
+
+int main(void)
+{
+    size_t columns, rows;
+    float* xs;
+    const size_t y_stride = 5;
+
+    // the inputs are standardized while loading, the target column is left as is
+    ColumnStats stats;
+    stats_init(&stats, FEATURES, NORM_STANDARD);
+    if (read_csv_normalized_f(g_filename, &xs, &columns, &rows, true, &stats, true) != 0)
+    {
+        return 1;
+    }
+    const float* ys = &xs[y_stride - 1];
+
+    srand(0);
+    LayerFC* layers[LAYERS_LEN] = {cog_layer_init(4, 8), cog_layer_init(8, 7),
+                                   cog_layer_init(7, 5), cog_layer_init(5, 1)};
+    LayerActivision lrelu       = cog_layer_activision_init(L_RELU);
+
+    // busses.c needs lr 0.0001 and 500 epochs on the raw inputs
+    const size_t epochs = 50;
+    const float lr      = 0.01;
+    for (size_t epoch = 0; epoch < epochs; epoch++)
+    {
+        for (size_t l = 0; l < LAYERS_LEN; l++)
+        {
+            cog_layer_zero_grad(layers[l]);
+        }
+        for (size_t pos = 0; pos < rows; pos++)
+        {
+            const float prediction = run(layers, lrelu, xs + (pos * y_stride));
+            const float d_mse      = cog_mse_deriv(ys[pos * y_stride], prediction);
+            cog_layer_backpropagate_batch(layers[3], &d_mse, rows);
+            cog_layer_part_derive(layers[3]);
+            cog_layer_backpropagate_batch(layers[2], layers[3]->part_derive, rows);
+            cog_layer_part_derive(layers[2]);
+            cog_layer_backpropagate_batch(layers[1], layers[2]->part_derive, rows);
+            cog_layer_part_derive(layers[1]);
+            cog_layer_backpropagate_batch(layers[0], layers[1]->part_derive, rows);
+        }
+        for (size_t l = 0; l < LAYERS_LEN; l++)
+        {
+            cog_layer_apply_derives(layers[l], lr);
+        }
+    }
+
+    float avg_mse                 = 0;
+    float* normalized_predictions = malloc(sizeof(float) * rows);
+    for (size_t pos = 0; pos < rows; pos++)
+    {
+        const float prediction      = run(layers, lrelu, xs + (pos * y_stride));
+        normalized_predictions[pos] = prediction;
+        avg_mse += cog_mse(ys[pos * y_stride], prediction) / rows;
+    }
+
+    // the stats are saved with the model and loaded for inference
+    FILE* fp = fopen(g_stats, "w");
+    write_stats_p(fp, &stats);
+    fclose(fp);
+    stats_destroy(&stats);
+    free_csv(xs);
+
+    fp = fopen(g_stats, "r");
+    read_stats_p(fp, &stats);
+    fclose(fp);
+    float scale[FEATURES], shift[FEATURES];
+    stats_affine(&stats, scale, shift);
+    stats_destroy(&stats);
+
+    // folded into the first layer the model runs on the raw inputs
+    const char* failed = NULL;
+    cog_layer_fold_input_affine(layers[0], scale, shift);
+    read_csv_f(g_filename, &xs, &columns, &rows, true);
+    for (size_t pos = 0; pos < rows; pos++)
+    {
+        const float prediction = run(layers, lrelu, xs + (pos * y_stride));
+        if (!(fabsf(prediction - normalized_predictions[pos]) <= 1e-3f * (fabsf(prediction) + 1)))
+        {
+            failed = "the folded layer is not the same as normalizing the inputs";
+        }
+    }
+    free_csv(xs);
+    free(normalized_predictions);
+
+    // stats of more columns than the file has must not be applied
+    ColumnStats wide;
+    stats_init(&wide, 2 * y_stride, NORM_STANDARD);
+    if (read_csv_normalized_f(g_filename, &xs, &columns, &rows, true, &wide, false) == 0)
+    {
+        failed = "stats wider than the file were applied";
+        free_csv(xs);
+    }
+    stats_destroy(&wide);
+
+    for (size_t l = 0; l < LAYERS_LEN; l++)
+    {
+        cog_layer_destroy(layers[l]);
+    }
+
+    const int max_mse = 190;
+    if (failed == NULL && !(avg_mse <= max_mse))
+    {
+        failed = "the avg mse is bigger then busses.c";
+    }
+    if (failed != NULL)
+    {
+        printf("\033[31m[-] %s test failed: %s: %f\033[0m\n", __FILE__, failed, avg_mse);
+    }
+    else
+    {
+        printf("\033[32m[+] %s \t\tpassed %f\033[0m\n", __FILE__, avg_mse);
+    }
+    return 0;
+}
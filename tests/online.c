@@ -0,0 +1,196 @@
+#define COGNI_THREADS
+#define COGNI_IMPLEMENTATION
+#include "cogni.h"
+
+#define READERS 4
+#define VERSIONS 2000
+#define LAYERS_LEN 3
+
+static ModelPublisher* g_publisher;
+static atomic_bool g_done;
+static atomic_int g_torn;
+// the output of every trained version on g_probe, written before the version is published
+static float g_expected[VERSIONS + 2];
+static const float g_probe[4] = {0.5, -1, 2, 0.25};
+
+/* every version of the trainer has all the parameters equal to the version number */
+static int reader(void* arg)
+{
+    UNUSED(arg);
+    float scratch[2 * 16];
+    const float xs[4] = {1, 2, 3, 4};
+    size_t last       = 0;
+    while (!atomic_load(&g_done))
+    {
+        const ModelSnapshot* snapshot = cog_publisher_acquire(g_publisher);
+        const float version           = snapshot->params[0];
+        for (size_t i = 0; i < g_publisher->params_len; i++)
+        {
+            if (snapshot->params[i] != version)
+            {
+                atomic_fetch_add(&g_torn, 1);
+                break;
+            }
+        }
+        if (snapshot->version < last)
+        {
+            // versions only go forward
+            atomic_fetch_add(&g_torn, 1);
+        }
+        last = snapshot->version;
+        cog_snapshot_run(g_publisher, snapshot, xs, scratch);
+        cog_publisher_release(g_publisher, snapshot);
+    }
+    return 0;
+}
+
+/* every version of the training writer gives its own output on the probe */
+static int trained_reader(void* arg)
+{
+    UNUSED(arg);
+    float scratch[2 * 16];
+    while (!atomic_load(&g_done))
+    {
+        const ModelSnapshot* snapshot = cog_publisher_acquire(g_publisher);
+        const float ys = cog_snapshot_run(g_publisher, snapshot, g_probe, scratch)[0];
+        if (ys != g_expected[snapshot->version])
+        {
+            atomic_fetch_add(&g_torn, 1);
+        }
+        cog_publisher_release(g_publisher, snapshot);
+    }
+    return 0;
+}
+
+static void set_params(Network* net, float value)
+{
+    for (size_t l = 0; l < net->len; l++)
+    {
+        LayerFC* layer = net->layers[l];
+        for (size_t i = 0; i < cog_layer_params_len(layer); i++)
+        {
+            layer->neurons[0].w[i] = value;
+        }
+    }
+}
+
+/* the writer trains with the single sample backprop and publishes while the readers serve */
+static const char* test_training(void)
+{
+    const size_t sizes[3]           = {4, 16, 1};
+    const Activision_type activs[2] = {L_RELU, NONE};
+    srand(0);
+    Network* trainer = cog_network_init(sizes, activs, 2);
+    LayerFC* hidden  = trainer->layers[0];
+    LayerFC* last    = trainer->layers[1];
+    g_expected[1]    = cog_network_run(trainer, g_probe)[0];
+    g_publisher      = cog_publisher_init(trainer, 3);
+    if (g_publisher == NULL)
+    {
+        cog_network_destroy(trainer);
+        return "could not init the publisher";
+    }
+
+    atomic_store(&g_done, false);
+    atomic_store(&g_torn, 0);
+    thrd_t readers[READERS];
+    for (size_t i = 0; i < READERS; i++)
+    {
+        thrd_create(&readers[i], trained_reader, NULL);
+    }
+
+    size_t version = 1;
+    while (version < VERSIONS)
+    {
+        float x[4];
+        cog_array_rand_f(x, 4, -1, 1);
+        const float y      = x[0] - 2 * x[1] + x[2] * x[3];
+        const float derive = cog_mse_deriv(y, cog_network_run(trainer, x)[0]);
+        cog_layer_backpropagate(last, &derive);
+        cog_layer_part_derive(last);
+        cog_layer_backpropagate(hidden, last->part_derive);
+        cog_layer_apply_derives(hidden, 0.01);
+        cog_layer_apply_derives(last, 0.01);
+
+        // no reader looks at a version before it is published
+        g_expected[version + 1] = cog_network_run(trainer, g_probe)[0];
+        version += cog_publisher_publish(g_publisher, trainer) == 0;
+    }
+    atomic_store(&g_done, true);
+    for (size_t i = 0; i < READERS; i++)
+    {
+        thrd_join(readers[i], NULL);
+    }
+
+    cog_publisher_destroy(g_publisher);
+    cog_network_destroy(trainer);
+    return atomic_load(&g_torn) != 0 ? "a reader saw a version that is not the trained one"
+                                     : NULL;
+}
+
+int main(void)
+{
+    const size_t sizes[LAYERS_LEN + 1]            = {4, 16, 8, 1};
+    const Activision_type activisions[LAYERS_LEN] = {RELU, RELU, NONE};
+    Network* trainer = cog_network_init(sizes, activisions, LAYERS_LEN);
+
+    const char* failed = NULL;
+    set_params(trainer, 0);
+    g_publisher = cog_publisher_init(trainer, 3);
+
+    // the snapshot gives the same output as the network it was published from
+    float scratch[2 * 16];
+    const float xs[4] = {1, -2, 3, 0.5};
+    cog_array_rand_f(trainer->layers[0]->neurons[0].w, 4 * 16, -1, 1);
+    cog_publisher_publish(g_publisher, trainer);
+    const ModelSnapshot* snapshot = cog_publisher_acquire(g_publisher);
+    const float expected          = cog_network_run(trainer, xs)[0];
+    if (cog_snapshot_run(g_publisher, snapshot, xs, scratch)[0] != expected)
+    {
+        failed = "the snapshot output is not the same as the network";
+    }
+    cog_publisher_release(g_publisher, snapshot);
+    set_params(trainer, 0);
+    cog_publisher_publish(g_publisher, trainer);
+
+    thrd_t readers[READERS];
+    for (size_t i = 0; i < READERS; i++)
+    {
+        thrd_create(&readers[i], reader, NULL);
+    }
+
+    // the trainer keeps updating its private copy and publishes when a slot is free
+    size_t published = 0;
+    for (size_t version = 1; published < VERSIONS; version++)
+    {
+        set_params(trainer, (float)version);
+        published += cog_publisher_publish(g_publisher, trainer) == 0;
+    }
+    atomic_store(&g_done, true);
+    for (size_t i = 0; i < READERS; i++)
+    {
+        thrd_join(readers[i], NULL);
+    }
+
+    if (atomic_load(&g_torn) != 0)
+    {
+        failed = "a reader saw a torn snapshot";
+    }
+
+    cog_publisher_destroy(g_publisher);
+    cog_network_destroy(trainer);
+    if (failed == NULL)
+    {
+        failed = test_training();
+    }
+
+    if (failed != NULL)
+    {
+        printf("\033[31m[-] %s test failed: %s\033[0m\n", __FILE__, failed);
+    }
+    else
+    {
+        printf("\033[32m[+] %s passed\033[0m\n", __FILE__);
+    }
+    return 0;
+}
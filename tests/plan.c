@@ -0,0 +1,133 @@
+#define COGNI_IMPLEMENTATION
+#include "cogni.h"
+
+#define LAYERS_LEN 5
+#define MAX_BATCH 16
+#define EPS 1e-3f
+#define TOL 1e-2f
+
+/* every batch of the plan against cog_network_run one sample at a time */
+static const char* test_plan(void)
+{
+    // a wide layer in the middle so the plan is sized by it and not by the inputs
+    const size_t sizes[LAYERS_LEN + 1]            = {6, 9, 32, 3, 12, 2};
+    const Activision_type activisions[LAYERS_LEN] = {L_RELU, SIGMOID, NONE, L_RELU, NONE};
+    srand(0);
+    Network* net      = cog_network_init(sizes, activisions, LAYERS_LEN);
+    NetworkPlan* plan = cog_network_plan_init(net, MAX_BATCH);
+    if (net == NULL || plan == NULL)
+    {
+        return "could not init";
+    }
+
+    const size_t in  = cog_network_in_features(net);
+    const size_t out = cog_network_out_features(net);
+    float xs[MAX_BATCH * 6];
+    cog_array_rand_f(xs, MAX_BATCH * in, -2, 2);
+
+    const char* failed = NULL;
+    // every batch size reuses the same plan buffers
+    for (size_t batch = 1; batch <= MAX_BATCH && failed == NULL; batch++)
+    {
+        const float* ys = cog_network_plan_run(net, plan, xs, batch);
+        for (size_t i = 0; i < batch && ys != NULL && failed == NULL; i++)
+        {
+            const float* expected = cog_network_run(net, &xs[i * in]);
+            for (size_t n = 0; n < out && failed == NULL; n++)
+            {
+                // the batch may sum in a different order
+                if (fabsf(ys[i * out + n] - expected[n]) > 1e-5f * (1 + fabsf(expected[n])))
+                {
+                    failed = "the plan output is not the same as cog_network_run";
+                }
+            }
+        }
+        failed = (ys == NULL) ? "could not run the plan" : failed;
+    }
+    if (failed == NULL && cog_network_plan_run(net, plan, xs, MAX_BATCH + 1) != NULL)
+    {
+        failed = "a batch bigger than the plan was run";
+    }
+
+    cog_network_plan_destroy(plan);
+    cog_network_destroy(net);
+    return failed;
+}
+
+static float loss(Network* net, const float* x, float y)
+{
+    return cog_mse(y, cog_network_run(net, x)[0]);
+}
+
+/* the layers keep xs by reference, the backprop must still see the inputs of the forward */
+static const char* test_backprop(void)
+{
+    const size_t sizes[3]           = {6, 9, 1};
+    const Activision_type activs[2] = {L_RELU, NONE};
+    srand(1);
+    Network* net      = cog_network_init(sizes, activs, 2);
+    NetworkPlan* plan = cog_network_plan_init(net, MAX_BATCH);
+    if (net == NULL || plan == NULL)
+    {
+        return "could not init";
+    }
+
+    float x[6], others[MAX_BATCH * 6];
+    cog_array_rand_f(x, 6, -2, 2);
+    cog_array_rand_f(others, MAX_BATCH * 6, -2, 2);
+    const float y = 0.5;
+
+    LayerFC* hidden  = net->layers[0];
+    LayerFC* last    = net->layers[1];
+    const float pred = cog_network_run(net, x)[0];
+    // the ping pong buffers of the plan must not clobber the inputs kept by the layers
+    cog_network_plan_run(net, plan, others, MAX_BATCH);
+    const float derive = cog_mse_deriv(y, pred);
+    cog_layer_backpropagate(last, &derive);
+    cog_layer_part_derive(last);
+    cog_layer_backpropagate(hidden, last->part_derive);
+
+    // finite differences of every weight and bias
+    const char* failed = NULL;
+    for (size_t l = 0; l < net->len && failed == NULL; l++)
+    {
+        float* w        = net->layers[l]->neurons[0].w;
+        const float* dw = net->layers[l]->neurons[0].dw;
+        for (size_t p = 0; p < cog_layer_params_len(net->layers[l]) && failed == NULL; p++)
+        {
+            const float saved = w[p];
+            w[p]              = saved + EPS;
+            const float up    = loss(net, x, y);
+            w[p]              = saved - EPS;
+            const float down  = loss(net, x, y);
+            w[p]              = saved;
+            if (fabsf((up - down) / (2 * EPS) - dw[p]) > TOL * (1 + fabsf(dw[p])))
+            {
+                failed = "the backprop derive is not the finite difference";
+            }
+        }
+    }
+
+    cog_network_plan_destroy(plan);
+    cog_network_destroy(net);
+    return failed;
+}
+
+int main(void)
+{
+    const char* (*tests[])(void) = {test_plan, test_backprop};
+    const char* fail             = NULL;
+    for (size_t i = 0; i < sizeof tests / sizeof *tests && fail == NULL; i++)
+    {
+        fail = tests[i]();
+    }
+    if (fail != NULL)
+    {
+        printf("\033[31m[-] %s test failed: %s\033[0m\n", __FILE__, fail);
+    }
+    else
+    {
+        printf("\033[32m[+] %s passed\033[0m\n", __FILE__);
+    }
+    return 0;
+}
@@ -0,0 +1,202 @@
+#define COGNI_IMPLEMENTATION
+#include "cogni.h"
+
+#define SERVER_IMPLEMENTATION
+#include "server.h"
+
+#include <sys/wait.h>
+
+#define CLIENTS 8
+#define REQUESTS 16
+#define MAX_BATCH 4
+#define MAX_DELAY_US 200000
+
+const char* g_socket = "build/server.sock";
+CogServer* g_server  = NULL;
+
+static void on_term(int sig)
+{
+    (void)sig;
+    cog_server_stop(g_server);
+}
+
+/* serves until SIGTERM, the exit status tells if concurrent requests were merged into a batch */
+static int serve(Network* net)
+{
+    g_server = cog_server_init(g_socket, net, MAX_BATCH, MAX_DELAY_US);
+    if (g_server == NULL)
+    {
+        return 1;
+    }
+    signal(SIGTERM, on_term);
+    const error err   = cog_server_run(g_server);
+    const bool merged = g_server->largest_batch > 1;
+    cog_server_destroy(g_server);
+    return (err != 0) ? 2 : (merged ? 0 : 3);
+}
+
+static bool receive_expected(Network* net, int fd, const float* xs)
+{
+    float ys = 0;
+    if (cog_client_receive(fd, &ys, 1) != 0)
+    {
+        return false;
+    }
+    const float expected = cog_network_run(net, xs)[0];
+    return fabsf(ys - expected) <= 1e-4f * fabsf(expected) + 1e-4f;
+}
+
+/* a socket file left by a server that died without cleaning up */
+static void make_stale_socket(void)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strcpy(addr.sun_path, g_socket);
+    unlink(g_socket);
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    bind(fd, (struct sockaddr*)&addr, sizeof addr);
+    close(fd);
+}
+
+int main(void)
+{
+    const size_t sizes[]                = {4, 8, 7, 5, 1};
+    const Activision_type activisions[] = {L_RELU, L_RELU, L_RELU, NONE};
+    Network* net                        = cog_network_init(sizes, activisions, 4);
+
+    make_stale_socket();
+    const pid_t pid = fork();
+    if (pid == 0)
+    {
+        exit(serve(net));
+    }
+
+    int fds[CLIENTS];
+    for (size_t c = 0; c < CLIENTS; c++)
+    {
+        // wait for the server to listen
+        fds[c] = -1;
+        for (size_t retry = 0; retry < 1000 && fds[c] < 0; retry++)
+        {
+            fds[c] = cog_client_connect(g_socket);
+            if (fds[c] < 0)
+            {
+                usleep(1000);
+            }
+        }
+    }
+
+    const char* failed = NULL;
+    if (cog_server_init(g_socket, net, 0, MAX_DELAY_US) != NULL)
+    {
+        failed = "a server with max_batch 0 was created";
+    }
+    // the live server must not be replaced
+    CogServer* second = cog_server_init(g_socket, net, MAX_BATCH, MAX_DELAY_US);
+    if (second != NULL)
+    {
+        failed = "a second server took the socket of a live one";
+        cog_server_destroy(second);
+    }
+
+    // a client that stops in the middle of a request must not stall the others
+    const int stalled     = cog_client_connect(g_socket);
+    const uint32_t header = 4;
+    const float half[2]   = {1, 2};
+    if (stalled < 0 || write(stalled, &header, sizeof header) != sizeof header ||
+        write(stalled, half, sizeof half) != sizeof half)
+    {
+        failed = "could not connect the stalled client";
+    }
+
+    float xs[CLIENTS][REQUESTS][4];
+    for (size_t c = 0; c < CLIENTS; c++)
+    {
+        cog_array_rand_f(&xs[c][0][0], REQUESTS * 4, 0, 10);
+        if (fds[c] < 0)
+        {
+            failed = "could not connect to the server";
+        }
+    }
+
+    // every client sends all its requests before reading so the server sees concurrent requests
+    for (size_t c = 0; c < CLIENTS && failed == NULL; c++)
+    {
+        for (size_t r = 0; r < REQUESTS; r++)
+        {
+            if (cog_client_send(fds[c], xs[c][r], 4) != 0)
+            {
+                failed = "could not send a request";
+            }
+        }
+    }
+    for (size_t c = 0; c < CLIENTS && failed == NULL; c++)
+    {
+        for (size_t r = 0; r < REQUESTS && failed == NULL; r++)
+        {
+            if (!receive_expected(net, fds[c], xs[c][r]))
+            {
+                failed = "the batched output is not the same as the network output";
+            }
+        }
+    }
+
+    // the last request waits for a batch that does not fill, the stop must still answer it
+    for (size_t r = 0; r < MAX_BATCH + 1 && failed == NULL; r++)
+    {
+        if (cog_client_send(fds[0], xs[0][r], 4) != 0)
+        {
+            failed = "could not send a request";
+        }
+    }
+    for (size_t r = 0; r < MAX_BATCH && failed == NULL; r++)
+    {
+        if (!receive_expected(net, fds[0], xs[0][r]))
+        {
+            failed = "the batched output is not the same as the network output";
+        }
+    }
+    usleep(MAX_DELAY_US / 10);
+    kill(pid, SIGTERM);
+    char byte;
+    if (failed == NULL && !receive_expected(net, fds[0], xs[0][MAX_BATCH]))
+    {
+        failed = "the collected batch was not answered on stop";
+    }
+    else if (failed == NULL && read(fds[0], &byte, 1) != 0)
+    {
+        failed = "the client socket was not closed on stop";
+    }
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (failed == NULL && (!WIFEXITED(status) || WEXITSTATUS(status) == 3))
+    {
+        failed = "no batch merged more than one request";
+    }
+    else if (failed == NULL && WEXITSTATUS(status) != 0)
+    {
+        failed = "the server did not stop cleanly";
+    }
+    else if (failed == NULL && access(g_socket, F_OK) == 0)
+    {
+        failed = "the socket file was left after the stop";
+    }
+
+    for (size_t c = 0; c < CLIENTS; c++)
+    {
+        close(fds[c]);
+    }
+    close(stalled);
+    unlink(g_socket);
+    cog_network_destroy(net);
+
+    if (failed != NULL)
+    {
+        printf("\033[31m[-] %s test failed: %s\033[0m\n", __FILE__, failed);
+    }
+    else
+    {
+        printf("\033[32m[+] %s passed\033[0m\n", __FILE__);
+    }
+    return 0;
+}
@@ -0,0 +1,136 @@
+#define COGNI_IMPLEMENTATION
+#include "cogni.h"
+
+#define LAYERS_LEN 3
+#define BATCH 32
+
+const char* g_path        = "build/tune.cache";
+const char* g_other_entry = "Some Other CPU\t32 64 128 1 32 64 256\n";
+
+static bool same_entry(const TuneEntry* a, const TuneEntry* b)
+{
+    return a->use_gemm == b->use_gemm && a->config.mc == b->config.mc &&
+           a->config.kc == b->config.kc && a->config.nc == b->config.nc;
+}
+
+static const char* test_tune(void)
+{
+    srand(0);
+    // two layers share a shape and are tuned once
+    const size_t sizes[LAYERS_LEN + 1]            = {64, 128, 128, 8};
+    const Activision_type activisions[LAYERS_LEN] = {RELU, RELU, NONE};
+    Network* net                                  = cog_network_init(sizes, activisions, LAYERS_LEN);
+
+    float xs[BATCH * 64], scratch[2 * BATCH * 128], expected[BATCH * 8];
+    cog_array_rand_f(xs, BATCH * 64, -1, 1);
+    memcpy(expected, cog_network_run_batch(net, xs, BATCH, scratch), sizeof expected);
+
+    // a cache shared with another machine
+    FILE* fp = fopen(g_path, "w");
+    fputs(g_other_entry, fp);
+    fclose(fp);
+
+    cog_tune_clear();
+    if (cog_tune_network(net, BATCH) != 0 || cog_tune_save(g_path) != 0)
+    {
+        cog_network_destroy(net);
+        return "could not tune";
+    }
+
+    TuneEntry tuned[LAYERS_LEN];
+    for (size_t l = 0; l < LAYERS_LEN; l++)
+    {
+        const TuneEntry* entry = cog_tune_lookup(BATCH, sizes[l], sizes[l + 1]);
+        if (entry == NULL)
+        {
+            cog_network_destroy(net);
+            return "a layer shape was not tuned";
+        }
+        tuned[l] = *entry;
+    }
+
+    const float* ys = cog_network_run_batch(net, xs, BATCH, scratch);
+    for (size_t i = 0; i < BATCH * 8; i++)
+    {
+        if (fabsf(ys[i] - expected[i]) > 1e-3f * (fabsf(expected[i]) + 1))
+        {
+            cog_network_destroy(net);
+            return "the tuned run is not the same";
+        }
+    }
+    cog_network_destroy(net);
+
+    cog_tune_clear();
+    if (cog_tune_lookup(BATCH, 64, 128) != NULL || cog_tune_load(g_path) != 0)
+    {
+        return "could not reload the cache";
+    }
+    for (size_t l = 0; l < LAYERS_LEN; l++)
+    {
+        const TuneEntry* entry = cog_tune_lookup(BATCH, sizes[l], sizes[l + 1]);
+        if (entry == NULL || !same_entry(entry, &tuned[l]))
+        {
+            return "the loaded cache is not the tuned one";
+        }
+    }
+
+    bool other_kept = false;
+    char line[512];
+    fp = fopen(g_path, "r");
+    while (fgets(line, sizeof line, fp) != NULL)
+    {
+        other_kept |= strcmp(line, g_other_entry) == 0;
+    }
+    fclose(fp);
+    cog_tune_clear();
+    return other_kept ? NULL : "the entry of the other cpu was dropped";
+}
+
+static const char* test_bad_cache(void)
+{
+    cog_tune_clear();
+    remove(g_path);
+    if (cog_tune_load(g_path) != 0 || cog_tune_lookup(BATCH, 64, 128) != NULL)
+    {
+        return "a missing cache is not an empty one";
+    }
+
+    // a zero block is skipped and the others are rounded to whole register blocks
+    char model[128];
+    cog_cpu_model(model, sizeof model);
+    FILE* fp = fopen(g_path, "w");
+    fprintf(fp, "%s\t8 4 4 1 0 16 16\n", model);
+    fprintf(fp, "%s\t8 5 5 1 6 16 3\n", model);
+    fclose(fp);
+    if (cog_tune_load(g_path) != 0)
+    {
+        return "could not load the cache";
+    }
+    const TuneEntry* zero    = cog_tune_lookup(8, 4, 4);
+    const TuneEntry* rounded = cog_tune_lookup(8, 5, 5);
+    const bool valid         = zero == NULL && rounded != NULL &&
+                               rounded->config.mc % COGNI_GEMM_MR == 0 &&
+                               rounded->config.nc % COGNI_GEMM_NR == 0;
+    cog_tune_clear();
+    return valid ? NULL : "a bad cache line was loaded as is";
+}
+
+int main(void)
+{
+    const char* fail = test_tune();
+    if (fail == NULL)
+    {
+        fail = test_bad_cache();
+    }
+    if (fail != NULL)
+    {
+        printf("\033[31m[-] %s test failed: %s\033[0m\n", __FILE__, fail);
+    }
+    else
+    {
+        char model[128];
+        cog_cpu_model(model, sizeof model);
+        printf("\033[32m[+] %s passed on '%s'\033[0m\n", __FILE__, model);
+    }
+    return 0;
+}
@@ -1,16 +1,70 @@
 #ifndef DATABASE_H
 #define DATABASE_H
 #include <errno.h>
+#include <math.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 typedef int error;
 
-/* uses malloc on data variable */
+/* plain malloc by default, so the data of read_csv_f can be freed with free. define
+   DATABASE_COGNI_ALLOCATOR with cogni.h included before the implementation to take the data from
+   the cogni allocator and count it as COG_MEM_DATASET, then only free_csv matches */
+#ifndef DATABASE_MALLOC
+#if defined(DATABASE_COGNI_ALLOCATOR) && defined(COGNI_INCLUDE_H)
+#define DATABASE_MALLOC(size) cog_malloc(size, COG_MEM_DATASET)
+#define DATABASE_CALLOC(count, size) cog_calloc(count, size, COG_MEM_DATASET)
+#define DATABASE_FREE(ptr) cog_free(ptr)
+#else
+#define DATABASE_MALLOC(size) malloc(size)
+#define DATABASE_CALLOC(count, size) calloc(count, size)
+#define DATABASE_FREE(ptr) free(ptr)
+#endif
+#endif
+
+typedef enum
+{
+    NORM_STANDARD = 0, // (x - mean) / std
+    NORM_MIN_MAX,      // (x - min) / (max - min)
+    NORM_LEN
+} Normalization_type;
+
+/* running statistics of the first `columns` columns */
+typedef struct ColumnStats
+{
+    Normalization_type type;
+    size_t columns;
+    size_t count;
+    double* mean;
+    double* m2; // sum of squared distances from the mean (welford)
+    float* min;
+    float* max;
+} ColumnStats;
+
+/* uses DATABASE_MALLOC on data variable, malloc by default - free with free_csv */
 error read_csv_f(const char* filename, float** data, size_t* columns, size_t* rows,
                  bool throw_first_row);
+/* uses DATABASE_MALLOC on data variable - free with free_csv. normalizes the first stats->columns
+   columns in place, when fit the stats are computed while reading, else the saved stats are
+   applied to every row as it is read */
+error read_csv_normalized_f(const char* filename, float** data, size_t* columns, size_t* rows,
+                            bool throw_first_row, ColumnStats* stats, bool fit);
+void free_csv(float* data);
 error get_csv_dimensions(FILE* csv_file, size_t* columns, size_t* rows);
+
+/* uses DATABASE_MALLOC - use stats_destroy */
+error stats_init(ColumnStats* stats, size_t columns, Normalization_type type);
+void stats_destroy(ColumnStats* stats);
+void stats_update(ColumnStats* stats, const float* row);
+/* normalized x = (x - shift) * scale */
+void stats_affine(const ColumnStats* stats, float* scale, float* shift);
+void normalize_row(const float* scale, const float* shift, size_t columns, float* row);
+error write_stats_p(FILE* fp, const ColumnStats* stats);
+error read_stats_p(FILE* fp, ColumnStats* stats);
+/* keeps in place only the rows where row % shards == shard */
+void shard_rows(float* data, size_t columns, size_t* rows, size_t shard, size_t shards);
 #endif // DATABASE_H
 
 #ifdef DATABASE_IMPLEMENTATION
@@ -53,9 +107,148 @@ error get_csv_dimensions(FILE* csv_file, size_t* columns, size_t* rows)
     return 0;
 }
 
-/* uses malloc on data */
+error stats_init(ColumnStats* stats, size_t columns, Normalization_type type)
+{
+    stats->type    = type;
+    stats->columns = columns;
+    stats->count   = 0;
+    stats->mean    = (double*)DATABASE_CALLOC(columns, sizeof(double));
+    stats->m2      = (double*)DATABASE_CALLOC(columns, sizeof(double));
+    stats->min     = (float*)DATABASE_MALLOC(sizeof(float) * columns);
+    stats->max     = (float*)DATABASE_MALLOC(sizeof(float) * columns);
+    if (stats->mean == NULL || stats->m2 == NULL || stats->min == NULL || stats->max == NULL)
+    {
+        fprintf(stderr, "ERROR: could not malloc stats: %s\n", strerror(errno));
+        stats_destroy(stats);
+        return 1;
+    }
+    for (size_t i = 0; i < columns; i++)
+    {
+        stats->min[i] = INFINITY;
+        stats->max[i] = -INFINITY;
+    }
+    return 0;
+}
+
+void stats_destroy(ColumnStats* stats)
+{
+    DATABASE_FREE(stats->mean);
+    DATABASE_FREE(stats->m2);
+    DATABASE_FREE(stats->min);
+    DATABASE_FREE(stats->max);
+    stats->mean = NULL;
+    stats->m2   = NULL;
+    stats->min  = NULL;
+    stats->max  = NULL;
+}
+
+void stats_update(ColumnStats* stats, const float* row)
+{
+    stats->count++;
+    for (size_t i = 0; i < stats->columns; i++)
+    {
+        // welford: stable in one pass even for large offsets
+        const double delta = row[i] - stats->mean[i];
+        stats->mean[i] += delta / stats->count;
+        stats->m2[i] += delta * (row[i] - stats->mean[i]);
+        stats->min[i] = (row[i] < stats->min[i]) ? row[i] : stats->min[i];
+        stats->max[i] = (row[i] > stats->max[i]) ? row[i] : stats->max[i];
+    }
+}
+
+void stats_affine(const ColumnStats* stats, float* scale, float* shift)
+{
+    for (size_t i = 0; i < stats->columns; i++)
+    {
+        double range = 0;
+        if (stats->type == NORM_MIN_MAX)
+        {
+            shift[i] = stats->min[i];
+            range    = (double)stats->max[i] - stats->min[i];
+        }
+        else
+        {
+            shift[i] = (float)stats->mean[i];
+            range    = (stats->count > 0) ? sqrt(stats->m2[i] / stats->count) : 0;
+        }
+        // a constant column is only shifted
+        scale[i] = (range > 0) ? (float)(1 / range) : 1;
+    }
+}
+
+void normalize_row(const float* scale, const float* shift, size_t columns, float* row)
+{
+    for (size_t i = 0; i < columns; i++)
+    {
+        row[i] = (row[i] - shift[i]) * scale[i];
+    }
+}
+
+void shard_rows(float* data, size_t columns, size_t* rows, size_t shard, size_t shards)
+{
+    size_t kept = 0;
+    for (size_t row = shard; row < *rows; row += shards)
+    {
+        memmove(&data[kept * columns], &data[row * columns], (sizeof *data) * columns);
+        kept++;
+    }
+    *rows = kept;
+}
+
+error write_stats_p(FILE* fp, const ColumnStats* stats)
+{
+    fprintf(fp, "%d %zu %zu\n", (int)stats->type, stats->columns, stats->count);
+    for (size_t i = 0; i < stats->columns; i++)
+    {
+        fprintf(fp, "%a %a %a %a\n", stats->mean[i], stats->m2[i], stats->min[i], stats->max[i]);
+    }
+    return 0;
+}
+
+/* uses DATABASE_MALLOC - use stats_destroy */
+error read_stats_p(FILE* fp, ColumnStats* stats)
+{
+    int type       = 0;
+    size_t columns = 0;
+    size_t count   = 0;
+    if (fscanf(fp, "%d %zu %zu\n", &type, &columns, &count) != 3 || type < 0 || type >= NORM_LEN)
+    {
+        fprintf(stderr, "ERROR: could not read stats\n");
+        return 1;
+    }
+    if (stats_init(stats, columns, (Normalization_type)type) != 0)
+    {
+        return 1;
+    }
+    stats->count = count;
+    for (size_t i = 0; i < columns; i++)
+    {
+        if (fscanf(fp, "%la %la %a %a\n", &stats->mean[i], &stats->m2[i], &stats->min[i],
+                   &stats->max[i]) != 4)
+        {
+            fprintf(stderr, "ERROR: could not read stats\n");
+            stats_destroy(stats);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void free_csv(float* data)
+{
+    DATABASE_FREE(data);
+}
+
+/* uses DATABASE_MALLOC on data */
 error read_csv_f(const char* filename, float** data, size_t* columns, size_t* rows,
                  bool throw_first_row)
+{
+    return read_csv_normalized_f(filename, data, columns, rows, throw_first_row, NULL, false);
+}
+
+/* uses DATABASE_MALLOC on data */
+error read_csv_normalized_f(const char* filename, float** data, size_t* columns, size_t* rows,
+                            bool throw_first_row, ColumnStats* stats, bool fit)
 {
     FILE* csv_file = fopen(filename, "r");
     if (csv_file == NULL)
@@ -73,15 +266,32 @@ error read_csv_f(const char* filename, float** data, size_t* columns, size_t* ro
         printf("file '%s' empty\n", filename);
         return 1;
     }
+    if (stats != NULL && stats->columns > *columns)
+    {
+        fclose(csv_file);
+        fprintf(stderr, "ERROR: stats of %zu columns for the %zu columns of '%s'\n",
+                stats->columns, *columns, filename);
+        return 1;
+    }
 
     (*rows) -= throw_first_row;
-    *data = (float*)malloc((sizeof **data) * (*columns) * (*rows));
-    if (*data == NULL)
+    *data = (float*)DATABASE_MALLOC((sizeof **data) * (*columns) * (*rows));
+    // [scale | shift] of the normalized columns
+    float* affine =
+        (stats != NULL) ? (float*)DATABASE_MALLOC(sizeof(float) * 2 * stats->columns) : NULL;
+    if (*data == NULL || (stats != NULL && affine == NULL))
     {
         fclose(csv_file);
-        fprintf(stderr, "ERROR: could not malloc data: %s", strerror(errno));
+        DATABASE_FREE(*data);
+        DATABASE_FREE(affine);
+        *data = NULL;
+        fprintf(stderr, "ERROR: could not malloc data: %s\n", strerror(errno));
         return 1;
     }
+    if (stats != NULL && !fit)
+    {
+        stats_affine(stats, affine, affine + stats->columns);
+    }
 
     // reset file position
     rewind(csv_file);
@@ -97,21 +307,46 @@ error read_csv_f(const char* filename, float** data, size_t* columns, size_t* ro
         if (getline(&buffer, &buffer_size, csv_file) == -1)
         {
             fclose(csv_file);
+            DATABASE_FREE(*data);
+            DATABASE_FREE(affine);
+            *data = NULL;
             printf("ERROR: could not read line in file: %s\n", filename);
             return 1;
         }
         char* buffer_ptr = buffer;
+        float* row       = &(*data)[line * (*columns)];
         for (size_t i = 0; i < *columns; i++)
         {
-            char* end_num                  = NULL;
-            (*data)[line * (*columns) + i] = strtof(buffer_ptr, &end_num);
-            buffer_ptr                     = end_num + 1;
+            char* end_num = NULL;
+            row[i]        = strtof(buffer_ptr, &end_num);
+            buffer_ptr    = end_num + 1;
         }
         free(buffer);
         buffer = NULL;
+
+        if (stats != NULL && fit)
+        {
+            stats_update(stats, row);
+        }
+        else if (stats != NULL)
+        {
+            normalize_row(affine, affine + stats->columns, stats->columns, row);
+        }
     }
     fclose(csv_file);
 
+    // the fitted stats are known only after the last row
+    if (stats != NULL && fit)
+    {
+        stats_affine(stats, affine, affine + stats->columns);
+        for (size_t line = 0; line < *rows; line++)
+        {
+            normalize_row(affine, affine + stats->columns, stats->columns,
+                          &(*data)[line * (*columns)]);
+        }
+    }
+    DATABASE_FREE(affine);
+
     return 0;
 }
 
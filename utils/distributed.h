@@ -0,0 +1,547 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <threads.h>
+#include <time.h>
+#include <unistd.h>
+
+/* cogni.h must be included before this file
+
+   Data parallel training: every worker process has the same network and a shard of the data.
+   After every layer backward its [dw | db] is averaged over all the workers with a ring
+   all-reduce, on a communication thread while the next layer backward is computed.
+
+   address is "unix:<path prefix>" (rank r listens on <path prefix>.r) or "tcp:<host>:<port>"
+   (rank r listens on <port> + r) */
+
+#define COG_RING_MAX_JOBS 64
+// how long cog_ring_init waits for its neighbours before failing
+#ifndef COG_RING_TIMEOUT_MS
+#define COG_RING_TIMEOUT_MS 30000
+#endif
+
+typedef struct RingJob
+{
+    float* data;
+    size_t len;
+} RingJob;
+
+typedef struct Ring
+{
+    size_t rank;
+    size_t world;
+    int next_fd; // sends to rank + 1
+    int prev_fd; // receives from rank - 1
+    float* recv_buffer;
+    size_t recv_len;
+
+    // queue of the async all-reduces, done by the communication thread in order
+    RingJob jobs[COG_RING_MAX_JOBS];
+    size_t jobs_head;
+    size_t jobs_tail;
+    thrd_t thread;
+    Allocator allocator; // of the thread that called init, the recv_buffer grows in the thread
+    mtx_t lock;
+    cnd_t cond;
+    bool stop;
+    error last_error;
+} Ring;
+
+/* uses cog_malloc - use cog_ring_destroy. all the workers must call it within COG_RING_TIMEOUT_MS
+   of each other */
+Ring* cog_ring_init(const char* address, size_t rank, size_t world);
+void cog_ring_destroy(Ring* ring);
+/* data becomes the average of data over all the workers. the queued async all-reduces are done
+   first so every worker runs them in the same order */
+error cog_ring_allreduce(Ring* ring, float* data, size_t len);
+/* queue an all-reduce, data must not be touched until cog_ring_wait */
+error cog_ring_allreduce_async(Ring* ring, float* data, size_t len);
+error cog_ring_wait(Ring* ring);
+
+/* One full batch gradient step over the rows of all the workers, the layers gradients are
+   all-reduced while the backward continues. the workers can have a different number of rows, every
+   row weighs the same, it fails when no worker has rows. row i is xs[i * stride] and its targets
+   ys[i * stride], loss is the avg mse of the local rows. all the workers must start from the same
+   weights */
+error cog_ring_train_epoch(Ring* ring, Network* net, const float* xs, const float* ys,
+                           size_t stride, size_t rows, float lr, float* loss);
+#endif // DISTRIBUTED_H
+
+#ifdef DISTRIBUTED_IMPLEMENTATION
+
+/* fills addr for rank and returns its length, 0 on a bad address */
+static socklen_t cog_ring_address(const char* address, size_t rank, struct sockaddr_storage* addr)
+{
+    memset(addr, 0, sizeof *addr);
+    if (strncmp(address, "unix:", 5) == 0)
+    {
+        struct sockaddr_un* un = (struct sockaddr_un*)addr;
+        un->sun_family         = AF_UNIX;
+        const int len = snprintf(un->sun_path, sizeof un->sun_path, "%s.%zu", address + 5, rank);
+        return (len > 0 && (size_t)len < sizeof un->sun_path) ? sizeof *un : 0;
+    }
+
+    if (strncmp(address, "tcp:", 4) == 0)
+    {
+        char host[256];
+        const char* port_pos = strrchr(address, ':');
+        const size_t host_len = (size_t)(port_pos - (address + 4));
+        if (port_pos == address + 3 || host_len >= sizeof host)
+        {
+            return 0;
+        }
+        memcpy(host, address + 4, host_len);
+        host[host_len] = '\0';
+
+        char port[16];
+        snprintf(port, sizeof port, "%ld", strtol(port_pos + 1, NULL, 10) + (long)rank);
+        struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_STREAM};
+        struct addrinfo* info = NULL;
+        if (getaddrinfo(host, port, &hints, &info) != 0 || info == NULL)
+        {
+            return 0;
+        }
+        const socklen_t len = info->ai_addrlen;
+        memcpy(addr, info->ai_addr, len);
+        freeaddrinfo(info);
+        return len;
+    }
+
+    return 0;
+}
+
+static int cog_ring_worker(void* arg);
+
+static long cog_ring_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+Ring* cog_ring_init(const char* address, size_t rank, size_t world)
+{
+    if (world == 0 || rank >= world)
+    {
+        fprintf(stderr, "ERROR: rank %zu is not in a ring of %zu workers\n", rank, world);
+        return NULL;
+    }
+    Ring* ring = cog_calloc(1, sizeof(Ring), COG_MEM_OTHER);
+    if (ring == NULL)
+    {
+        fprintf(stderr, "ERROR: could not malloc ring\n");
+        return NULL;
+    }
+    ring->rank    = rank;
+    ring->world   = world;
+    ring->next_fd = -1;
+    ring->prev_fd = -1;
+    mtx_init(&ring->lock, mtx_plain);
+    cnd_init(&ring->cond);
+
+    int listen_fd = -1;
+    if (world > 1)
+    {
+        struct sockaddr_storage own, next;
+        const socklen_t own_len  = cog_ring_address(address, rank, &own);
+        const socklen_t next_len = cog_ring_address(address, (rank + 1) % world, &next);
+        if (own_len == 0 || next_len == 0)
+        {
+            fprintf(stderr, "ERROR: bad ring address '%s'\n", address);
+            goto fail;
+        }
+
+        // listen before connecting so all the workers can start in any order
+        const int one = 1;
+        listen_fd     = socket(own.ss_family, SOCK_STREAM, 0);
+        if (own.ss_family == AF_UNIX)
+        {
+            unlink(((struct sockaddr_un*)&own)->sun_path);
+        }
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+        if (listen_fd < 0 || bind(listen_fd, (struct sockaddr*)&own, own_len) != 0 ||
+            listen(listen_fd, 1) != 0)
+        {
+            fprintf(stderr, "ERROR: rank %zu could not listen: %s\n", rank, strerror(errno));
+            goto fail;
+        }
+
+        // a missing neighbour fails the init instead of hanging every rank
+        const long deadline = cog_ring_now_ms() + COG_RING_TIMEOUT_MS;
+        while (ring->next_fd < 0 && cog_ring_now_ms() < deadline)
+        {
+            ring->next_fd = socket(next.ss_family, SOCK_STREAM, 0);
+            if (connect(ring->next_fd, (struct sockaddr*)&next, next_len) != 0)
+            {
+                close(ring->next_fd);
+                ring->next_fd = -1;
+                usleep(1000);
+            }
+        }
+        struct pollfd pending = {.fd = listen_fd, .events = POLLIN};
+        long remaining        = deadline - cog_ring_now_ms();
+        while (ring->next_fd >= 0 && remaining > 0 && poll(&pending, 1, (int)remaining) < 0 &&
+               errno == EINTR)
+        {
+            remaining = deadline - cog_ring_now_ms();
+        }
+        if (ring->next_fd >= 0 && (pending.revents & POLLIN))
+        {
+            ring->prev_fd = accept(listen_fd, NULL, NULL);
+        }
+        if (ring->next_fd < 0 || ring->prev_fd < 0)
+        {
+            fprintf(stderr, "ERROR: rank %zu could not connect the ring in %dms\n", rank,
+                    COG_RING_TIMEOUT_MS);
+            goto fail;
+        }
+        if (next.ss_family != AF_UNIX)
+        {
+            setsockopt(ring->next_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+        }
+        // the exchange polls both directions so a full socket buffer never blocks
+        fcntl(ring->next_fd, F_SETFL, fcntl(ring->next_fd, F_GETFL) | O_NONBLOCK);
+        fcntl(ring->prev_fd, F_SETFL, fcntl(ring->prev_fd, F_GETFL) | O_NONBLOCK);
+        close(listen_fd);
+        if (own.ss_family == AF_UNIX)
+        {
+            unlink(((struct sockaddr_un*)&own)->sun_path);
+        }
+        listen_fd = -1;
+    }
+
+    ring->allocator = cog_get_allocator();
+    if (thrd_create(&ring->thread, cog_ring_worker, ring) != thrd_success)
+    {
+        fprintf(stderr, "ERROR: could not start the ring thread\n");
+        goto fail;
+    }
+    return ring;
+
+fail:
+    if (listen_fd >= 0)
+    {
+        close(listen_fd);
+    }
+    if (ring->next_fd >= 0)
+    {
+        close(ring->next_fd);
+    }
+    if (ring->prev_fd >= 0)
+    {
+        close(ring->prev_fd);
+    }
+    mtx_destroy(&ring->lock);
+    cnd_destroy(&ring->cond);
+    cog_free(ring);
+    return NULL;
+}
+
+void cog_ring_destroy(Ring* ring)
+{
+    if (ring == NULL)
+    {
+        return;
+    }
+    mtx_lock(&ring->lock);
+    ring->stop = true;
+    cnd_broadcast(&ring->cond);
+    mtx_unlock(&ring->lock);
+    thrd_join(ring->thread, NULL);
+
+    if (ring->next_fd >= 0)
+    {
+        close(ring->next_fd);
+    }
+    if (ring->prev_fd >= 0)
+    {
+        close(ring->prev_fd);
+    }
+    mtx_destroy(&ring->lock);
+    cnd_destroy(&ring->cond);
+    cog_free(ring->recv_buffer);
+    cog_free(ring);
+}
+
+/* send to next and receive from prev at the same time */
+static error cog_ring_exchange(Ring* ring, const float* send_data, size_t send_len,
+                               float* recv_data, size_t recv_len)
+{
+    const char* send_pos = (const char*)send_data;
+    char* recv_pos       = (char*)recv_data;
+    size_t send_left     = (sizeof *send_data) * send_len;
+    size_t recv_left     = (sizeof *recv_data) * recv_len;
+    while (send_left > 0 || recv_left > 0)
+    {
+        struct pollfd fds[2] = {{.fd = ring->next_fd, .events = (send_left > 0) ? POLLOUT : 0},
+                                {.fd = ring->prev_fd, .events = (recv_left > 0) ? POLLIN : 0}};
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return 1;
+        }
+        if (send_left > 0 && (fds[0].revents & (POLLOUT | POLLERR | POLLHUP)))
+        {
+            const ssize_t sent = send(ring->next_fd, send_pos, send_left, MSG_NOSIGNAL);
+            if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                return 1;
+            }
+            send_pos += (sent > 0) ? sent : 0;
+            send_left -= (sent > 0) ? (size_t)sent : 0;
+        }
+        if (recv_left > 0 && (fds[1].revents & (POLLIN | POLLERR | POLLHUP)))
+        {
+            const ssize_t got = recv(ring->prev_fd, recv_pos, recv_left, 0);
+            if (got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+            {
+                return 1;
+            }
+            recv_pos += (got > 0) ? got : 0;
+            recv_left -= (got > 0) ? (size_t)got : 0;
+        }
+    }
+    return 0;
+}
+
+/* chunk i of len split into world chunks */
+static void cog_ring_chunk(const Ring* ring, size_t len, size_t chunk, size_t* start, size_t* size)
+{
+    const size_t base  = len / ring->world;
+    const size_t extra = len % ring->world;
+    *start             = chunk * base + ((chunk < extra) ? chunk : extra);
+    *size              = base + (chunk < extra);
+}
+
+/* the all-reduce itself, only one runs at a time: the communication thread or
+   cog_ring_allreduce after the queue is empty */
+static error cog_ring_reduce(Ring* ring, float* data, size_t len)
+{
+    const size_t world = ring->world;
+    if (world == 1)
+    {
+        return 0;
+    }
+
+    const size_t max_chunk = len / world + 1;
+    if (ring->recv_len < max_chunk)
+    {
+        cog_free(ring->recv_buffer);
+        ring->recv_buffer = cog_malloc(sizeof(float) * max_chunk, COG_MEM_OTHER);
+        ring->recv_len    = (ring->recv_buffer != NULL) ? max_chunk : 0;
+        if (ring->recv_buffer == NULL)
+        {
+            fprintf(stderr, "ERROR: could not malloc ring buffer\n");
+            return 1;
+        }
+    }
+
+    // reduce-scatter: after world - 1 steps rank owns the full sum of chunk rank + 1
+    for (size_t step = 0; step + 1 < world; step++)
+    {
+        size_t send_start, send_size, recv_start, recv_size;
+        cog_ring_chunk(ring, len, (ring->rank + world - step) % world, &send_start, &send_size);
+        cog_ring_chunk(ring, len, (ring->rank + world - step - 1) % world, &recv_start,
+                       &recv_size);
+        if (cog_ring_exchange(ring, &data[send_start], send_size, ring->recv_buffer, recv_size) !=
+            0)
+        {
+            return 1;
+        }
+        for (size_t i = 0; i < recv_size; i++)
+        {
+            data[recv_start + i] += ring->recv_buffer[i];
+        }
+    }
+
+    // all-gather: pass the finished chunks around, every rank ends with the same bits
+    for (size_t step = 0; step + 1 < world; step++)
+    {
+        size_t send_start, send_size, recv_start, recv_size;
+        cog_ring_chunk(ring, len, (ring->rank + 1 + world - step) % world, &send_start,
+                       &send_size);
+        cog_ring_chunk(ring, len, (ring->rank + world - step) % world, &recv_start, &recv_size);
+        if (cog_ring_exchange(ring, &data[send_start], send_size, &data[recv_start], recv_size) !=
+            0)
+        {
+            return 1;
+        }
+    }
+
+    for (size_t i = 0; i < len; i++)
+    {
+        data[i] /= (float)world;
+    }
+    return 0;
+}
+
+error cog_ring_allreduce(Ring* ring, float* data, size_t len)
+{
+    // the sockets and the receive buffer belong to the communication thread until it is idle
+    mtx_lock(&ring->lock);
+    while (ring->jobs_head != ring->jobs_tail)
+    {
+        cnd_wait(&ring->cond, &ring->lock);
+    }
+    mtx_unlock(&ring->lock);
+    return cog_ring_reduce(ring, data, len);
+}
+
+static int cog_ring_worker(void* arg)
+{
+    Ring* ring = arg;
+    cog_set_allocator(ring->allocator);
+    mtx_lock(&ring->lock);
+    while (true)
+    {
+        while (ring->jobs_head == ring->jobs_tail && !ring->stop)
+        {
+            cnd_wait(&ring->cond, &ring->lock);
+        }
+        if (ring->jobs_head == ring->jobs_tail)
+        {
+            break;
+        }
+
+        const RingJob job = ring->jobs[ring->jobs_head % COG_RING_MAX_JOBS];
+        mtx_unlock(&ring->lock);
+        const error err = cog_ring_reduce(ring, job.data, job.len);
+        mtx_lock(&ring->lock);
+
+        ring->last_error |= err;
+        ring->jobs_head++;
+        cnd_broadcast(&ring->cond);
+    }
+    mtx_unlock(&ring->lock);
+    return 0;
+}
+
+error cog_ring_allreduce_async(Ring* ring, float* data, size_t len)
+{
+    mtx_lock(&ring->lock);
+    while (ring->jobs_tail - ring->jobs_head == COG_RING_MAX_JOBS)
+    {
+        cnd_wait(&ring->cond, &ring->lock);
+    }
+    ring->jobs[ring->jobs_tail % COG_RING_MAX_JOBS] = (RingJob){.data = data, .len = len};
+    ring->jobs_tail++;
+    cnd_broadcast(&ring->cond);
+    mtx_unlock(&ring->lock);
+    return 0;
+}
+
+error cog_ring_wait(Ring* ring)
+{
+    mtx_lock(&ring->lock);
+    while (ring->jobs_head != ring->jobs_tail)
+    {
+        cnd_wait(&ring->cond, &ring->lock);
+    }
+    const error err  = ring->last_error;
+    ring->last_error = 0;
+    mtx_unlock(&ring->lock);
+    return err;
+}
+
+error cog_ring_train_epoch(Ring* ring, Network* net, const float* xs, const float* ys,
+                           size_t stride, size_t rows, float lr, float* loss)
+{
+    const size_t in  = cog_network_in_features(net);
+    const size_t out = cog_network_out_features(net);
+
+    // the all-reduce averages the workers, a worker with more rows must weigh more
+    float avg_rows = (float)rows;
+    if (cog_ring_allreduce(ring, &avg_rows, 1) != 0)
+    {
+        return 1;
+    }
+    if (avg_rows == 0)
+    {
+        fprintf(stderr, "ERROR: no rows to train on in the ring\n");
+        return 1;
+    }
+    const float weight = (float)rows / avg_rows;
+
+    // [rows x in] inputs, then every layer outputs, then two [rows x widest] delta buffers
+    size_t len = rows * in;
+    for (size_t l = 0; l < net->len; l++)
+    {
+        len += rows * net->layers[l]->len;
+    }
+    const size_t width = cog_network_max_width(net);
+
+    float* scratch = cog_malloc(sizeof(float) * (len + 2 * rows * width), COG_MEM_ACTIVATIONS);
+    float** acts   = cog_malloc(sizeof(float*) * (net->len + 1), COG_MEM_OTHER);
+    if (scratch == NULL || acts == NULL)
+    {
+        fprintf(stderr, "ERROR: could not malloc epoch data\n");
+        cog_free(scratch);
+        cog_free(acts);
+        return 1;
+    }
+    float* deltas[2] = {scratch + len, scratch + len + rows * width};
+
+    acts[0] = scratch;
+    for (size_t i = 0; i < rows; i++)
+    {
+        memcpy(&acts[0][i * in], &xs[i * stride], (sizeof *xs) * in);
+    }
+    for (size_t l = 0; l < net->len; l++)
+    {
+        acts[l + 1] = acts[l] + rows * ((l == 0) ? in : net->layers[l - 1]->len);
+        cog_layer_run_batch(net->layers[l], acts[l], acts[l + 1], rows);
+        cog_activate_array(net->activisions[l], acts[l + 1], rows * net->layers[l]->len);
+    }
+
+    float local_loss = 0;
+    for (size_t i = 0; i < rows; i++)
+    {
+        for (size_t n = 0; n < out; n++)
+        {
+            const float pred            = acts[net->len][i * out + n];
+            local_loss                 += cog_mse(ys[i * stride + n], pred) / rows;
+            deltas[0][i * out + n]      = cog_mse_deriv(ys[i * stride + n], pred) * weight;
+        }
+    }
+
+    for (size_t l = net->len; l-- > 0;)
+    {
+        LayerFC* layer = net->layers[l];
+        cog_layer_zero_grad(layer);
+        float* grad_in = (l > 0) ? deltas[(net->len - l) % 2] : NULL;
+        cog_layer_backward_batch(layer, net->activisions[l], acts[l], acts[l + 1],
+                                 deltas[(net->len - l + 1) % 2], grad_in, rows);
+        // [dw | db] is one block, it travels while the previous layer backward is computed
+        cog_ring_allreduce_async(ring, layer->neurons[0].dw, cog_layer_params_len(layer));
+    }
+    const error err = cog_ring_wait(ring);
+
+    for (size_t l = 0; l < net->len && err == 0; l++)
+    {
+        cog_layer_apply_derives(net->layers[l], lr);
+    }
+    if (loss != NULL)
+    {
+        *loss = local_loss;
+    }
+
+    cog_free(scratch);
+    cog_free(acts);
+    return err;
+}
+
+#endif // DISTRIBUTED_IMPLEMENTATION
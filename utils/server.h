@@ -0,0 +1,680 @@
+#ifndef SERVER_H
+#define SERVER_H
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* cogni.h must be included before this file
+
+   Protocol over a unix socket, native byte order:
+    request:  uint32_t len (the network inputs count) then float[len]
+    response: uint32_t len (the network outputs count) then float[len]
+   a client can send the next request before reading the response, the responses are in order
+   the server never blocks on a client, a client that does not read its responses is not read from
+   until they are sent */
+
+#define COG_SERVER_MAX_CLIENTS (FD_SETSIZE - 1)
+#define COG_SERVER_MAX_PENDING (64 * 1024) // bytes of responses a client can leave unread
+#define COG_SERVER_DRAIN_US 1000000L       // how long a stop waits for the clients to read
+
+typedef struct CogServerClient
+{
+    int fd;
+
+    // the request that is being read, header then the inputs
+    char* request;
+    size_t request_got;
+
+    // the responses that are not sent yet
+    char* pending;
+    size_t pending_sent;
+    size_t pending_len;
+    size_t pending_cap;
+} CogServerClient;
+
+typedef struct CogServer
+{
+    int listen_fd;
+    bool bound;
+    char* path;
+    Network* net;
+
+    size_t max_batch;
+    long max_delay_us;
+
+    CogServerClient* clients;
+    size_t clients_len;
+
+    // the batch that is being collected
+    int* batch_fds;
+    float* batch_inputs;
+    size_t batch_len;
+    struct timeval batch_deadline;
+
+    // how the requests were merged, to tune max_batch and max_delay_us
+    size_t batches;
+    size_t largest_batch;
+
+    NetworkPlan* plan;
+    volatile sig_atomic_t stop;
+} CogServer;
+
+/* uses cog_malloc - use cog_server_destroy
+   fails if a live server already listens on path, a stale socket file is replaced */
+CogServer* cog_server_init(const char* path, Network* net, size_t max_batch, long max_delay_us);
+/* serve until cog_server_stop, a batch is run when it is full or max_delay_us after its first
+   request. on stop the collected batch is answered and the responses are sent for up to
+   COG_SERVER_DRAIN_US */
+error cog_server_run(CogServer* server);
+/* safe to call from a signal handler */
+void cog_server_stop(CogServer* server);
+void cog_server_destroy(CogServer* server);
+
+int cog_client_connect(const char* path);
+error cog_client_send(int fd, const float* xs, size_t in_len);
+error cog_client_receive(int fd, float* ys, size_t out_len);
+error cog_client_predict(int fd, const float* xs, size_t in_len, float* ys, size_t out_len);
+#endif // SERVER_H
+
+#ifdef SERVER_IMPLEMENTATION
+
+#ifdef MSG_NOSIGNAL
+#define COG_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define COG_SEND_FLAGS 0
+#endif
+
+static error cog_read_full(int fd, void* buffer, size_t len)
+{
+    char* pos = buffer;
+    while (len > 0)
+    {
+        ssize_t got = read(fd, pos, len);
+        if (got < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (got <= 0)
+        {
+            return 1;
+        }
+        pos += got;
+        len -= (size_t)got;
+    }
+    return 0;
+}
+
+static error cog_write_full(int fd, const void* buffer, size_t len)
+{
+    const char* pos = buffer;
+    while (len > 0)
+    {
+        ssize_t sent = send(fd, pos, len, COG_SEND_FLAGS);
+        if (sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (sent <= 0)
+        {
+            return 1;
+        }
+        pos += sent;
+        len -= (size_t)sent;
+    }
+    return 0;
+}
+
+static error cog_send_message(int fd, const float* data, size_t len)
+{
+    const uint32_t header = (uint32_t)len;
+    if (cog_write_full(fd, &header, sizeof header) != 0)
+    {
+        return 1;
+    }
+    return cog_write_full(fd, data, (sizeof *data) * len);
+}
+
+static error cog_receive_message(int fd, float* data, size_t len)
+{
+    uint32_t header = 0;
+    if (cog_read_full(fd, &header, sizeof header) != 0)
+    {
+        return 1;
+    }
+    if (header != len)
+    {
+        fprintf(stderr, "ERROR: expected %zu floats but got %u\n", len, header);
+        return 1;
+    }
+    return cog_read_full(fd, data, (sizeof *data) * len);
+}
+
+static error cog_set_nonblocking(int fd)
+{
+    const int flags = fcntl(fd, F_GETFL);
+    return flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0;
+}
+
+/* removes a socket file no server listens on anymore, a live one is left alone */
+static error cog_remove_stale_socket(const struct sockaddr_un* addr)
+{
+    struct stat st;
+    if (lstat(addr->sun_path, &st) != 0)
+    {
+        return 0;
+    }
+    if (!S_ISSOCK(st.st_mode))
+    {
+        fprintf(stderr, "ERROR: '%s' exists and is not a socket\n", addr->sun_path);
+        return 1;
+    }
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        return 1;
+    }
+    const bool live    = connect(fd, (const struct sockaddr*)addr, sizeof *addr) == 0;
+    const bool refused = !live && errno == ECONNREFUSED;
+    close(fd);
+    if (live)
+    {
+        fprintf(stderr, "ERROR: a server is already listening on '%s'\n", addr->sun_path);
+        return 1;
+    }
+    if (!refused)
+    {
+        fprintf(stderr, "ERROR: could not check '%s': %s\n", addr->sun_path, strerror(errno));
+        return 1;
+    }
+    return unlink(addr->sun_path) != 0;
+}
+
+CogServer* cog_server_init(const char* path, Network* net, size_t max_batch, long max_delay_us)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof addr.sun_path)
+    {
+        fprintf(stderr, "ERROR: socket path '%s' is too long\n", path);
+        return NULL;
+    }
+    if (max_batch == 0 || max_delay_us < 0)
+    {
+        fprintf(stderr, "ERROR: the server needs max_batch > 0 and max_delay_us >= 0\n");
+        return NULL;
+    }
+    strcpy(addr.sun_path, path);
+
+    CogServer* server = cog_malloc(sizeof(CogServer), COG_MEM_OTHER);
+    if (server == NULL)
+    {
+        fprintf(stderr, "ERROR: could not malloc server\n");
+        return NULL;
+    }
+
+    const size_t in       = cog_network_in_features(net);
+    server->net           = net;
+    server->max_batch     = max_batch;
+    server->max_delay_us  = max_delay_us;
+    server->clients_len   = 0;
+    server->batch_len     = 0;
+    server->batches       = 0;
+    server->largest_batch = 0;
+    server->stop          = 0;
+    server->bound         = false;
+    server->path          = cog_malloc(strlen(path) + 1, COG_MEM_OTHER);
+    server->clients   = cog_malloc(sizeof(CogServerClient) * COG_SERVER_MAX_CLIENTS, COG_MEM_OTHER);
+    server->batch_fds = cog_malloc(sizeof(int) * max_batch, COG_MEM_OTHER);
+    server->batch_inputs = cog_malloc(sizeof(float) * max_batch * in, COG_MEM_ACTIVATIONS);
+    server->plan         = cog_network_plan_init(net, max_batch);
+    server->listen_fd    = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server->path == NULL || server->clients == NULL || server->batch_fds == NULL ||
+        server->batch_inputs == NULL || server->plan == NULL || server->listen_fd < 0)
+    {
+        fprintf(stderr, "ERROR: could not create server: %s\n", strerror(errno));
+        cog_server_destroy(server);
+        return NULL;
+    }
+    strcpy(server->path, path);
+
+    if (cog_remove_stale_socket(&addr) != 0)
+    {
+        cog_server_destroy(server);
+        return NULL;
+    }
+    if (bind(server->listen_fd, (struct sockaddr*)&addr, sizeof addr) != 0)
+    {
+        fprintf(stderr, "ERROR: could not bind '%s': %s\n", path, strerror(errno));
+        cog_server_destroy(server);
+        return NULL;
+    }
+    server->bound = true;
+    if (listen(server->listen_fd, SOMAXCONN) != 0 || cog_set_nonblocking(server->listen_fd) != 0)
+    {
+        fprintf(stderr, "ERROR: could not listen on '%s': %s\n", path, strerror(errno));
+        cog_server_destroy(server);
+        return NULL;
+    }
+
+    return server;
+}
+
+static void cog_server_add_client(CogServer* server, int fd)
+{
+    const size_t in         = cog_network_in_features(server->net);
+    CogServerClient* client = &server->clients[server->clients_len];
+    client->fd              = fd;
+    client->request         = cog_malloc(sizeof(uint32_t) + sizeof(float) * in, COG_MEM_OTHER);
+    client->request_got     = 0;
+    client->pending         = NULL;
+    client->pending_sent    = 0;
+    client->pending_len     = 0;
+    client->pending_cap     = 0;
+    if (client->request == NULL || cog_set_nonblocking(fd) != 0)
+    {
+        cog_free(client->request);
+        close(fd);
+        return;
+    }
+    server->clients_len++;
+}
+
+static void cog_server_drop_client(CogServer* server, size_t index)
+{
+    CogServerClient* client = &server->clients[index];
+    const int fd            = client->fd;
+    close(fd);
+    cog_free(client->request);
+    cog_free(client->pending);
+    *client = server->clients[--server->clients_len];
+
+    // the requests it already queued are dropped when the batch is answered
+    for (size_t i = 0; i < server->batch_len; i++)
+    {
+        if (server->batch_fds[i] == fd)
+        {
+            server->batch_fds[i] = -1;
+        }
+    }
+}
+
+static size_t cog_server_find_client(const CogServer* server, int fd)
+{
+    for (size_t i = 0; i < server->clients_len; i++)
+    {
+        if (server->clients[i].fd == fd)
+        {
+            return i;
+        }
+    }
+    return server->clients_len;
+}
+
+/* sends what the socket takes without waiting, returns 1 if the client is gone */
+static error cog_server_send_pending(CogServerClient* client)
+{
+    while (client->pending_sent < client->pending_len)
+    {
+        const ssize_t sent = send(client->fd, &client->pending[client->pending_sent],
+                                  client->pending_len - client->pending_sent, COG_SEND_FLAGS);
+        if (sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return 0;
+        }
+        if (sent <= 0)
+        {
+            return 1;
+        }
+        client->pending_sent += (size_t)sent;
+    }
+    client->pending_sent = 0;
+    client->pending_len  = 0;
+    return 0;
+}
+
+static error cog_server_queue_response(CogServerClient* client, const float* ys, size_t len)
+{
+    const uint32_t header = (uint32_t)len;
+    const size_t size     = sizeof header + sizeof(float) * len;
+
+    // move the unsent bytes to the front before growing
+    if (client->pending_sent > 0)
+    {
+        client->pending_len -= client->pending_sent;
+        memmove(client->pending, &client->pending[client->pending_sent], client->pending_len);
+        client->pending_sent = 0;
+    }
+    if (client->pending_len + size > client->pending_cap)
+    {
+        const size_t cap = 2 * (client->pending_len + size);
+        char* pending    = cog_malloc(cap, COG_MEM_OTHER);
+        if (pending == NULL)
+        {
+            return 1;
+        }
+        if (client->pending_len > 0)
+        {
+            memcpy(pending, client->pending, client->pending_len);
+        }
+        cog_free(client->pending);
+        client->pending     = pending;
+        client->pending_cap = cap;
+    }
+    memcpy(&client->pending[client->pending_len], &header, sizeof header);
+    memcpy(&client->pending[client->pending_len + sizeof header], ys, sizeof(float) * len);
+    client->pending_len += size;
+    return cog_server_send_pending(client);
+}
+
+static void cog_server_flush(CogServer* server)
+{
+    const size_t out = cog_network_out_features(server->net);
+    const float* ys  = cog_network_plan_run(server->net, server->plan, server->batch_inputs,
+                                            server->batch_len);
+    server->batches++;
+    if (server->largest_batch < server->batch_len)
+    {
+        server->largest_batch = server->batch_len;
+    }
+    for (size_t i = 0; i < server->batch_len; i++)
+    {
+        if (server->batch_fds[i] < 0)
+        {
+            continue;
+        }
+        const size_t index = cog_server_find_client(server, server->batch_fds[i]);
+        if (index < server->clients_len &&
+            cog_server_queue_response(&server->clients[index], &ys[i * out], out) != 0)
+        {
+            cog_server_drop_client(server, index);
+        }
+    }
+    server->batch_len = 0;
+}
+
+static void cog_deadline_after(struct timeval* deadline, long us)
+{
+    gettimeofday(deadline, NULL);
+    deadline->tv_usec += us;
+    deadline->tv_sec += deadline->tv_usec / 1000000L;
+    deadline->tv_usec %= 1000000L;
+}
+
+/* reads what the socket has of the next request, returns 1 if the client is gone or broke the
+   protocol */
+static error cog_server_read_request(CogServer* server, CogServerClient* client)
+{
+    const size_t in   = cog_network_in_features(server->net);
+    const size_t size = sizeof(uint32_t) + sizeof(float) * in;
+    while (client->request_got < size)
+    {
+        const ssize_t got =
+            read(client->fd, &client->request[client->request_got], size - client->request_got);
+        if (got < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return 0;
+        }
+        if (got <= 0)
+        {
+            return 1;
+        }
+        client->request_got += (size_t)got;
+
+        uint32_t header = 0;
+        if (client->request_got >= sizeof header)
+        {
+            memcpy(&header, client->request, sizeof header);
+            if (header != in)
+            {
+                fprintf(stderr, "ERROR: expected %zu floats but got %u\n", in, header);
+                return 1;
+            }
+        }
+    }
+
+    if (server->batch_len == 0)
+    {
+        cog_deadline_after(&server->batch_deadline, server->max_delay_us);
+    }
+    memcpy(&server->batch_inputs[server->batch_len * in], &client->request[sizeof(uint32_t)],
+           sizeof(float) * in);
+    server->batch_fds[server->batch_len++] = client->fd;
+    client->request_got                    = 0;
+    return 0;
+}
+
+static long cog_time_until(const struct timeval* deadline)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (deadline->tv_sec - now.tv_sec) * 1000000L + (deadline->tv_usec - now.tv_usec);
+}
+
+/* sends the responses that are left, a client that does not read them in COG_SERVER_DRAIN_US
+   loses them */
+static void cog_server_drain(CogServer* server)
+{
+    struct timeval deadline;
+    cog_deadline_after(&deadline, COG_SERVER_DRAIN_US);
+    while (cog_time_until(&deadline) > 0)
+    {
+        fd_set write_fds;
+        FD_ZERO(&write_fds);
+        int max_fd = -1;
+        for (size_t i = 0; i < server->clients_len; i++)
+        {
+            const CogServerClient* client = &server->clients[i];
+            if (client->pending_len > client->pending_sent)
+            {
+                FD_SET(client->fd, &write_fds);
+                max_fd = (client->fd > max_fd) ? client->fd : max_fd;
+            }
+        }
+        if (max_fd < 0)
+        {
+            return;
+        }
+
+        const long remaining   = cog_time_until(&deadline);
+        struct timeval timeout = {.tv_sec  = (remaining > 0) ? remaining / 1000000L : 0,
+                                  .tv_usec = (remaining > 0) ? remaining % 1000000L : 0};
+        if (select(max_fd + 1, NULL, &write_fds, NULL, &timeout) < 0 && errno != EINTR)
+        {
+            return;
+        }
+        for (size_t i = 0; i < server->clients_len; i++)
+        {
+            if (FD_ISSET(server->clients[i].fd, &write_fds) &&
+                cog_server_send_pending(&server->clients[i]) != 0)
+            {
+                cog_server_drop_client(server, i);
+                i--;
+            }
+        }
+    }
+}
+
+error cog_server_run(CogServer* server)
+{
+    while (!server->stop)
+    {
+        fd_set read_fds, write_fds;
+        FD_ZERO(&read_fds);
+        FD_ZERO(&write_fds);
+        FD_SET(server->listen_fd, &read_fds);
+        int max_fd = server->listen_fd;
+        for (size_t i = 0; i < server->clients_len; i++)
+        {
+            const CogServerClient* client = &server->clients[i];
+            const size_t unsent           = client->pending_len - client->pending_sent;
+            if (unsent < COG_SERVER_MAX_PENDING)
+            {
+                FD_SET(client->fd, &read_fds);
+            }
+            if (unsent > 0)
+            {
+                FD_SET(client->fd, &write_fds);
+            }
+            max_fd = (client->fd > max_fd) ? client->fd : max_fd;
+        }
+
+        // wakes up now and then so a stop from another thread is seen
+        long remaining = 100000L;
+        if (server->batch_len > 0)
+        {
+            remaining = cog_time_until(&server->batch_deadline);
+            remaining = (remaining > 0) ? remaining : 0;
+        }
+        struct timeval timeout = {.tv_sec  = remaining / 1000000L,
+                                  .tv_usec = remaining % 1000000L};
+
+        const int ready = select(max_fd + 1, &read_fds, &write_fds, NULL, &timeout);
+        if (ready < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            fprintf(stderr, "ERROR: select failed: %s\n", strerror(errno));
+            return 1;
+        }
+
+        if (FD_ISSET(server->listen_fd, &read_fds))
+        {
+            const int fd = accept(server->listen_fd, NULL, NULL);
+            if (fd >= 0 && server->clients_len < COG_SERVER_MAX_CLIENTS && fd < FD_SETSIZE)
+            {
+                cog_server_add_client(server, fd);
+            }
+            else if (fd >= 0)
+            {
+                close(fd);
+            }
+        }
+
+        for (size_t i = 0; i < server->clients_len; i++)
+        {
+            CogServerClient* client = &server->clients[i];
+            const bool readable     = FD_ISSET(client->fd, &read_fds);
+            const bool writable     = FD_ISSET(client->fd, &write_fds);
+            if ((writable && cog_server_send_pending(client) != 0) ||
+                (readable && cog_server_read_request(server, client) != 0))
+            {
+                cog_server_drop_client(server, i);
+                // the last client was moved into i
+                i--;
+                continue;
+            }
+            if (server->batch_len == server->max_batch)
+            {
+                cog_server_flush(server);
+            }
+        }
+
+        if (server->batch_len > 0 && cog_time_until(&server->batch_deadline) <= 0)
+        {
+            cog_server_flush(server);
+        }
+    }
+
+    if (server->batch_len > 0)
+    {
+        cog_server_flush(server);
+    }
+    cog_server_drain(server);
+    return 0;
+}
+
+void cog_server_stop(CogServer* server)
+{
+    server->stop = 1;
+}
+
+void cog_server_destroy(CogServer* server)
+{
+    if (server == NULL)
+    {
+        return;
+    }
+    while (server->clients_len > 0)
+    {
+        cog_server_drop_client(server, server->clients_len - 1);
+    }
+    if (server->listen_fd >= 0)
+    {
+        close(server->listen_fd);
+    }
+    // not the socket of a live server it refused to replace
+    if (server->bound)
+    {
+        unlink(server->path);
+    }
+    cog_free(server->path);
+    cog_free(server->clients);
+    cog_free(server->batch_fds);
+    cog_free(server->batch_inputs);
+    cog_network_plan_destroy(server->plan);
+    cog_free(server);
+}
+
+int cog_client_connect(const char* path)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof addr.sun_path)
+    {
+        fprintf(stderr, "ERROR: socket path '%s' is too long\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr*)&addr, sizeof addr) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+error cog_client_send(int fd, const float* xs, size_t in_len)
+{
+    return cog_send_message(fd, xs, in_len);
+}
+
+error cog_client_receive(int fd, float* ys, size_t out_len)
+{
+    return cog_receive_message(fd, ys, out_len);
+}
+
+error cog_client_predict(int fd, const float* xs, size_t in_len, float* ys, size_t out_len)
+{
+    if (cog_client_send(fd, xs, in_len) != 0)
+    {
+        return 1;
+    }
+    return cog_client_receive(fd, ys, out_len);
+}
+
+#endif // SERVER_IMPLEMENTATION